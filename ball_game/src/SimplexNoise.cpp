@@ -293,6 +293,76 @@ float SimplexNoise::noise(float x, float y) {
     return 45.23065f * (n0 + n1 + n2);
 }
 
+/**
+ * Gradient vector grad() takes the dot product with, for the analytic derivatives
+ *
+ * @param[in] hash  hash value
+ * @param[out] gx   x component
+ * @param[out] gy   y component
+ */
+static void gradVector(int32_t hash, float& gx, float& gy) {
+    const int32_t h = hash & 0x3F;
+    const float u = (h & 1) ? -1.0f : 1.0f;
+    const float v = (h & 2) ? -2.0f : 2.0f;
+    gx = h < 4 ? u : v;
+    gy = h < 4 ? v : u;
+}
+
+/**
+ * Contribution of one simplex corner, t^4 * dot(g, d), added to the value and its derivatives
+ */
+static void cornerWithDerivatives(int32_t hash, float x, float y, float& n, float& dx, float& dy) {
+    const float t = 0.5f - x * x - y * y;
+    if (t < 0.0f) {
+        return;
+    }
+    float gx, gy;
+    gradVector(hash, gx, gy);
+    const float t2 = t * t;
+    const float t4 = t2 * t2;
+    const float g = gx * x + gy * y;
+    // d/dx t^4 g = -8 t^3 x g + t^4 gx, the simplex cell is constant around the point
+    n += t4 * g;
+    dx += t4 * gx - 8.0f * t2 * t * x * g;
+    dy += t4 * gy - 8.0f * t2 * t * y * g;
+}
+
+/**
+ * 2D Perlin simplex noise with its analytic derivatives
+ *
+ * @param[in] x float coordinate
+ * @param[in] y float coordinate
+ *
+ * @return Noise value as noise(x, y) gives it, with its partial derivatives along x and y
+ */
+SimplexNoise::Derivatives SimplexNoise::noiseWithDerivatives(float x, float y) {
+    static const float F2 = 0.366025403f;
+    static const float G2 = 0.211324865f;
+
+    const float s = (x + y) * F2;
+    const int32_t i = fastfloor(x + s);
+    const int32_t j = fastfloor(y + s);
+
+    const float t = static_cast<float>(i + j) * G2;
+    const float x0 = x - (i - t);
+    const float y0 = y - (j - t);
+
+    const int32_t i1 = x0 > y0 ? 1 : 0;
+    const int32_t j1 = x0 > y0 ? 0 : 1;
+
+    const float x1 = x0 - i1 + G2;
+    const float y1 = y0 - j1 + G2;
+    const float x2 = x0 - 1.0f + 2.0f * G2;
+    const float y2 = y0 - 1.0f + 2.0f * G2;
+
+    float n = 0.0f, dx = 0.0f, dy = 0.0f;
+    cornerWithDerivatives(hash(i + hash(j)), x0, y0, n, dx, dy);
+    cornerWithDerivatives(hash(i + i1 + hash(j + j1)), x1, y1, n, dx, dy);
+    cornerWithDerivatives(hash(i + 1 + hash(j + 1)), x2, y2, n, dx, dy);
+
+    return { 45.23065f * n, 45.23065f * dx, 45.23065f * dy };
+}
+
 
 /**
  * 3D Perlin simplex noise
@@ -460,6 +530,39 @@ float SimplexNoise::fractal(size_t octaves, float x, float y) const {
     return (output / denom);
 }
 
+/**
+ * Fractal/Fractional Brownian Motion (fBm) summation of 2D Perlin Simplex noise with its analytic derivatives.
+ * Each octave's derivatives are scaled by its frequency (chain rule) as well as its amplitude.
+ *
+ * @param[in] octaves   number of fraction of noise to sum
+ * @param[in] x         x float coordinate
+ * @param[in] y         y float coordinate
+ *
+ * @return Noise value as fractal(octaves, x, y) gives it, with its partial derivatives along x and y
+ */
+SimplexNoise::Derivatives SimplexNoise::fractalWithDerivatives(size_t octaves, float x, float y) const {
+    Derivatives output = { 0.f, 0.f, 0.f };
+    float denom = 0.f;
+    float frequency = mFrequency;
+    float amplitude = mAmplitude;
+
+    for (size_t i = 0; i < octaves; i++) {
+        const Derivatives octave = noiseWithDerivatives(x * frequency, y * frequency);
+        output.value += amplitude * octave.value;
+        output.dx += amplitude * frequency * octave.dx;
+        output.dy += amplitude * frequency * octave.dy;
+        denom += amplitude;
+
+        frequency *= mLacunarity;
+        amplitude *= mPersistence;
+    }
+
+    output.value /= denom;
+    output.dx /= denom;
+    output.dy /= denom;
+    return output;
+}
+
 /**
  * Fractal/Fractional Brownian Motion (fBm) summation of 3D Perlin Simplex noise
  *
@@ -485,4 +588,557 @@ float SimplexNoise::fractal(size_t octaves, float x, float y, float z) const {
     }
 
     return (output / denom);
-}
\ No newline at end of file
+}
+
+/*
+ * Batched 2D noise
+ *
+ * The batch kernels evaluate the exact same arithmetic as noise(float, float) and fractal(), lane by lane,
+ * so results match the scalar path to within float rounding. The permutation table is widened to 32 bits
+ * so the AVX2 kernel can hash 8 corners with a single gather, SSE4.1 has no gather and looks the lanes up one by one.
+ * The kernel is chosen once at runtime from the CPU features.
+ */
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMPLEXNOISE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SIMPLEXNOISE_TARGET_SSE41
+#define SIMPLEXNOISE_TARGET_AVX2
+#else
+#define SIMPLEXNOISE_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define SIMPLEXNOISE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+typedef void (*Fractal2DKernel)(size_t octaves, float frequency, float amplitude, float lacunarity, float persistence,
+                                const float* xs, const float* ys, float* out, size_t n);
+typedef void (*Fractal2DDerivativesKernel)(size_t octaves, float frequency, float amplitude, float lacunarity, float persistence,
+                                           const float* xs, const float* ys, float* out, float* dxs, float* dys, size_t n);
+
+/**
+ * Scalar batch kernel, also used for the tail of the vector kernels
+ */
+static void fractal2DScalar(size_t octaves, float frequency, float amplitude, float lacunarity, float persistence,
+                            const float* xs, const float* ys, float* out, size_t n) {
+    const SimplexNoise simplex(frequency, amplitude, lacunarity, persistence);
+    for (size_t k = 0; k < n; k++) {
+        out[k] = simplex.fractal(octaves, xs[k], ys[k]);
+    }
+}
+
+static void fractal2DDerivativesScalar(size_t octaves, float frequency, float amplitude, float lacunarity, float persistence,
+                                       const float* xs, const float* ys, float* out, float* dxs, float* dys, size_t n) {
+    const SimplexNoise simplex(frequency, amplitude, lacunarity, persistence);
+    for (size_t k = 0; k < n; k++) {
+        const SimplexNoise::Derivatives sample = simplex.fractalWithDerivatives(octaves, xs[k], ys[k]);
+        out[k] = sample.value;
+        dxs[k] = sample.dx;
+        dys[k] = sample.dy;
+    }
+}
+
+#if defined(SIMPLEXNOISE_X86)
+
+// perm[] widened to 32 bits so it can be gathered
+static const int32_t perm32[256] = {
+    151, 160, 137, 91, 90, 15,
+    131, 13, 201, 95, 96, 53, 194, 233, 7, 225, 140, 36, 103, 30, 69, 142, 8, 99, 37, 240, 21, 10, 23,
+    190, 6, 148, 247, 120, 234, 75, 0, 26, 197, 62, 94, 252, 219, 203, 117, 35, 11, 32, 57, 177, 33,
+    88, 237, 149, 56, 87, 174, 20, 125, 136, 171, 168, 68, 175, 74, 165, 71, 134, 139, 48, 27, 166,
+    77, 146, 158, 231, 83, 111, 229, 122, 60, 211, 133, 230, 220, 105, 92, 41, 55, 46, 245, 40, 244,
+    102, 143, 54, 65, 25, 63, 161, 1, 216, 80, 73, 209, 76, 132, 187, 208, 89, 18, 169, 200, 196,
+    135, 130, 116, 188, 159, 86, 164, 100, 109, 198, 173, 186, 3, 64, 52, 217, 226, 250, 124, 123,
+    5, 202, 38, 147, 118, 126, 255, 82, 85, 212, 207, 206, 59, 227, 47, 16, 58, 17, 182, 189, 28, 42,
+    223, 183, 170, 213, 119, 248, 152, 2, 44, 154, 163, 70, 221, 153, 101, 155, 167, 43, 172, 9,
+    129, 22, 39, 253, 19, 98, 108, 110, 79, 113, 224, 232, 178, 185, 112, 104, 218, 246, 97, 228,
+    251, 34, 242, 193, 238, 210, 144, 12, 191, 179, 162, 241, 81, 51, 145, 235, 249, 14, 239, 107,
+    49, 192, 214, 31, 181, 199, 106, 157, 184, 84, 204, 176, 115, 121, 50, 45, 127, 4, 150, 254,
+    138, 236, 205, 93, 222, 114, 67, 29, 24, 72, 243, 141, 128, 195, 78, 66, 215, 61, 156, 180
+};
+
+/**
+ * SSE4.1 helpers, 4 lanes at a time
+ */
+SIMPLEXNOISE_TARGET_SSE41 static inline __m128i hashSSE41(__m128i i) {
+    alignas(16) int32_t lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), _mm_and_si128(i, _mm_set1_epi32(0xFF)));
+    return _mm_setr_epi32(perm32[lanes[0]], perm32[lanes[1]], perm32[lanes[2]], perm32[lanes[3]]);
+}
+
+SIMPLEXNOISE_TARGET_SSE41 static inline __m128 gradSSE41(__m128i hash, __m128 x, __m128 y) {
+    const __m128i h = _mm_and_si128(hash, _mm_set1_epi32(0x3F));
+    const __m128 lowHash = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4)));
+    const __m128 u = _mm_blendv_ps(y, x, lowHash);
+    const __m128 v = _mm_mul_ps(_mm_set1_ps(2.0f), _mm_blendv_ps(x, y, lowHash));
+    const __m128 signU = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31));
+    const __m128 signV = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30));
+    return _mm_add_ps(_mm_xor_ps(u, signU), _mm_xor_ps(v, signV));
+}
+
+SIMPLEXNOISE_TARGET_SSE41 static inline __m128 cornerSSE41(__m128 x, __m128 y, __m128i hash) {
+    __m128 t = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(0.5f), _mm_mul_ps(x, x)), _mm_mul_ps(y, y));
+    t = _mm_max_ps(t, _mm_setzero_ps());
+    t = _mm_mul_ps(t, t);
+    return _mm_mul_ps(_mm_mul_ps(t, t), gradSSE41(hash, x, y));
+}
+
+SIMPLEXNOISE_TARGET_SSE41 static inline __m128 noiseSSE41(__m128 x, __m128 y) {
+    const float F2 = 0.366025403f;
+    const float G2 = 0.211324865f;
+
+    const __m128 s = _mm_mul_ps(_mm_add_ps(x, y), _mm_set1_ps(F2));
+    const __m128i i = _mm_cvttps_epi32(_mm_floor_ps(_mm_add_ps(x, s)));
+    const __m128i j = _mm_cvttps_epi32(_mm_floor_ps(_mm_add_ps(y, s)));
+
+    const __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(i, j)), _mm_set1_ps(G2));
+    const __m128 x0 = _mm_sub_ps(x, _mm_sub_ps(_mm_cvtepi32_ps(i), t));
+    const __m128 y0 = _mm_sub_ps(y, _mm_sub_ps(_mm_cvtepi32_ps(j), t));
+
+    // lower triangle (1,0) when x0 > y0, upper triangle (0,1) otherwise
+    const __m128i lower = _mm_castps_si128(_mm_cmpgt_ps(x0, y0));
+    const __m128i i1 = _mm_and_si128(lower, _mm_set1_epi32(1));
+    const __m128i j1 = _mm_andnot_si128(lower, _mm_set1_epi32(1));
+
+    const __m128 x1 = _mm_add_ps(_mm_sub_ps(x0, _mm_cvtepi32_ps(i1)), _mm_set1_ps(G2));
+    const __m128 y1 = _mm_add_ps(_mm_sub_ps(y0, _mm_cvtepi32_ps(j1)), _mm_set1_ps(G2));
+    const __m128 x2 = _mm_add_ps(_mm_sub_ps(x0, _mm_set1_ps(1.0f)), _mm_set1_ps(2.0f * G2));
+    const __m128 y2 = _mm_add_ps(_mm_sub_ps(y0, _mm_set1_ps(1.0f)), _mm_set1_ps(2.0f * G2));
+
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i gi0 = hashSSE41(_mm_add_epi32(i, hashSSE41(j)));
+    const __m128i gi1 = hashSSE41(_mm_add_epi32(_mm_add_epi32(i, i1), hashSSE41(_mm_add_epi32(j, j1))));
+    const __m128i gi2 = hashSSE41(_mm_add_epi32(_mm_add_epi32(i, one), hashSSE41(_mm_add_epi32(j, one))));
+
+    const __m128 n = _mm_add_ps(_mm_add_ps(cornerSSE41(x0, y0, gi0), cornerSSE41(x1, y1, gi1)), cornerSSE41(x2, y2, gi2));
+    return _mm_mul_ps(_mm_set1_ps(45.23065f), n);
+}
+
+SIMPLEXNOISE_TARGET_SSE41 static void fractal2DSSE41(size_t octaves, float frequency, float amplitude, float lacunarity, float persistence,
+                                                     const float* xs, const float* ys, float* out, size_t n) {
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        const __m128 x = _mm_loadu_ps(xs + k);
+        const __m128 y = _mm_loadu_ps(ys + k);
+        __m128 output = _mm_setzero_ps();
+        float denom = 0.f;
+        float octaveFrequency = frequency;
+        float octaveAmplitude = amplitude;
+
+        for (size_t octave = 0; octave < octaves; octave++) {
+            const __m128 f = _mm_set1_ps(octaveFrequency);
+            const __m128 value = noiseSSE41(_mm_mul_ps(x, f), _mm_mul_ps(y, f));
+            output = _mm_add_ps(output, _mm_mul_ps(_mm_set1_ps(octaveAmplitude), value));
+            denom += octaveAmplitude;
+
+            octaveFrequency *= lacunarity;
+            octaveAmplitude *= persistence;
+        }
+        _mm_storeu_ps(out + k, _mm_div_ps(output, _mm_set1_ps(denom)));
+    }
+    fractal2DScalar(octaves, frequency, amplitude, lacunarity, persistence, xs + k, ys + k, out + k, n - k);
+}
+
+SIMPLEXNOISE_TARGET_SSE41 static inline void cornerDerivativesSSE41(__m128 x, __m128 y, __m128i hash, __m128& n, __m128& dx, __m128& dy) {
+    const __m128i h = _mm_and_si128(hash, _mm_set1_epi32(0x3F));
+    const __m128 lowHash = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4)));
+    const __m128 u = _mm_xor_ps(_mm_set1_ps(1.0f), _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31)));
+    const __m128 v = _mm_xor_ps(_mm_set1_ps(2.0f), _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30)));
+    const __m128 gx = _mm_blendv_ps(v, u, lowHash);
+    const __m128 gy = _mm_blendv_ps(u, v, lowHash);
+
+    __m128 t = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(0.5f), _mm_mul_ps(x, x)), _mm_mul_ps(y, y));
+    t = _mm_max_ps(t, _mm_setzero_ps());
+    const __m128 t2 = _mm_mul_ps(t, t);
+    const __m128 t4 = _mm_mul_ps(t2, t2);
+    const __m128 g = _mm_add_ps(_mm_mul_ps(gx, x), _mm_mul_ps(gy, y));
+    const __m128 m = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(-8.0f), _mm_mul_ps(t2, t)), g);
+    n = _mm_add_ps(n, _mm_mul_ps(t4, g));
+    dx = _mm_add_ps(dx, _mm_add_ps(_mm_mul_ps(t4, gx), _mm_mul_ps(m, x)));
+    dy = _mm_add_ps(dy, _mm_add_ps(_mm_mul_ps(t4, gy), _mm_mul_ps(m, y)));
+}
+
+SIMPLEXNOISE_TARGET_SSE41 static inline void noiseDerivativesSSE41(__m128 x, __m128 y, __m128& n, __m128& dx, __m128& dy) {
+    const float F2 = 0.366025403f;
+    const float G2 = 0.211324865f;
+
+    const __m128 s = _mm_mul_ps(_mm_add_ps(x, y), _mm_set1_ps(F2));
+    const __m128i i = _mm_cvttps_epi32(_mm_floor_ps(_mm_add_ps(x, s)));
+    const __m128i j = _mm_cvttps_epi32(_mm_floor_ps(_mm_add_ps(y, s)));
+
+    const __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(i, j)), _mm_set1_ps(G2));
+    const __m128 x0 = _mm_sub_ps(x, _mm_sub_ps(_mm_cvtepi32_ps(i), t));
+    const __m128 y0 = _mm_sub_ps(y, _mm_sub_ps(_mm_cvtepi32_ps(j), t));
+
+    const __m128i lower = _mm_castps_si128(_mm_cmpgt_ps(x0, y0));
+    const __m128i i1 = _mm_and_si128(lower, _mm_set1_epi32(1));
+    const __m128i j1 = _mm_andnot_si128(lower, _mm_set1_epi32(1));
+
+    const __m128 x1 = _mm_add_ps(_mm_sub_ps(x0, _mm_cvtepi32_ps(i1)), _mm_set1_ps(G2));
+    const __m128 y1 = _mm_add_ps(_mm_sub_ps(y0, _mm_cvtepi32_ps(j1)), _mm_set1_ps(G2));
+    const __m128 x2 = _mm_add_ps(_mm_sub_ps(x0, _mm_set1_ps(1.0f)), _mm_set1_ps(2.0f * G2));
+    const __m128 y2 = _mm_add_ps(_mm_sub_ps(y0, _mm_set1_ps(1.0f)), _mm_set1_ps(2.0f * G2));
+
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i gi0 = hashSSE41(_mm_add_epi32(i, hashSSE41(j)));
+    const __m128i gi1 = hashSSE41(_mm_add_epi32(_mm_add_epi32(i, i1), hashSSE41(_mm_add_epi32(j, j1))));
+    const __m128i gi2 = hashSSE41(_mm_add_epi32(_mm_add_epi32(i, one), hashSSE41(_mm_add_epi32(j, one))));
+
+    n = _mm_setzero_ps();
+    dx = _mm_setzero_ps();
+    dy = _mm_setzero_ps();
+    cornerDerivativesSSE41(x0, y0, gi0, n, dx, dy);
+    cornerDerivativesSSE41(x1, y1, gi1, n, dx, dy);
+    cornerDerivativesSSE41(x2, y2, gi2, n, dx, dy);
+    const __m128 scale = _mm_set1_ps(45.23065f);
+    n = _mm_mul_ps(scale, n);
+    dx = _mm_mul_ps(scale, dx);
+    dy = _mm_mul_ps(scale, dy);
+}
+
+SIMPLEXNOISE_TARGET_SSE41 static void fractal2DDerivativesSSE41(size_t octaves, float frequency, float amplitude, float lacunarity, float persistence,
+                                                                const float* xs, const float* ys, float* out, float* dxs, float* dys, size_t n) {
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        const __m128 x = _mm_loadu_ps(xs + k);
+        const __m128 y = _mm_loadu_ps(ys + k);
+        __m128 output = _mm_setzero_ps();
+        __m128 outputDx = _mm_setzero_ps();
+        __m128 outputDy = _mm_setzero_ps();
+        float denom = 0.f;
+        float octaveFrequency = frequency;
+        float octaveAmplitude = amplitude;
+
+        for (size_t octave = 0; octave < octaves; octave++) {
+            const __m128 f = _mm_set1_ps(octaveFrequency);
+            __m128 value, dx, dy;
+            noiseDerivativesSSE41(_mm_mul_ps(x, f), _mm_mul_ps(y, f), value, dx, dy);
+            const __m128 a = _mm_set1_ps(octaveAmplitude);
+            const __m128 af = _mm_set1_ps(octaveAmplitude * octaveFrequency);
+            output = _mm_add_ps(output, _mm_mul_ps(a, value));
+            outputDx = _mm_add_ps(outputDx, _mm_mul_ps(af, dx));
+            outputDy = _mm_add_ps(outputDy, _mm_mul_ps(af, dy));
+            denom += octaveAmplitude;
+
+            octaveFrequency *= lacunarity;
+            octaveAmplitude *= persistence;
+        }
+        const __m128 d = _mm_set1_ps(denom);
+        _mm_storeu_ps(out + k, _mm_div_ps(output, d));
+        _mm_storeu_ps(dxs + k, _mm_div_ps(outputDx, d));
+        _mm_storeu_ps(dys + k, _mm_div_ps(outputDy, d));
+    }
+    fractal2DDerivativesScalar(octaves, frequency, amplitude, lacunarity, persistence, xs + k, ys + k, out + k, dxs + k, dys + k, n - k);
+}
+
+/**
+ * AVX2 helpers, 8 lanes at a time with gathered hashes
+ */
+SIMPLEXNOISE_TARGET_AVX2 static inline __m256i hashAVX2(__m256i i) {
+    return _mm256_i32gather_epi32(perm32, _mm256_and_si256(i, _mm256_set1_epi32(0xFF)), 4);
+}
+
+SIMPLEXNOISE_TARGET_AVX2 static inline __m256 gradAVX2(__m256i hash, __m256 x, __m256 y) {
+    const __m256i h = _mm256_and_si256(hash, _mm256_set1_epi32(0x3F));
+    const __m256 lowHash = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+    const __m256 u = _mm256_blendv_ps(y, x, lowHash);
+    const __m256 v = _mm256_mul_ps(_mm256_set1_ps(2.0f), _mm256_blendv_ps(x, y, lowHash));
+    const __m256 signU = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31));
+    const __m256 signV = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30));
+    return _mm256_add_ps(_mm256_xor_ps(u, signU), _mm256_xor_ps(v, signV));
+}
+
+SIMPLEXNOISE_TARGET_AVX2 static inline __m256 cornerAVX2(__m256 x, __m256 y, __m256i hash) {
+    __m256 t = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(0.5f), _mm256_mul_ps(x, x)), _mm256_mul_ps(y, y));
+    t = _mm256_max_ps(t, _mm256_setzero_ps());
+    t = _mm256_mul_ps(t, t);
+    return _mm256_mul_ps(_mm256_mul_ps(t, t), gradAVX2(hash, x, y));
+}
+
+SIMPLEXNOISE_TARGET_AVX2 static inline __m256 noiseAVX2(__m256 x, __m256 y) {
+    const float F2 = 0.366025403f;
+    const float G2 = 0.211324865f;
+
+    const __m256 s = _mm256_mul_ps(_mm256_add_ps(x, y), _mm256_set1_ps(F2));
+    const __m256i i = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(x, s)));
+    const __m256i j = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(y, s)));
+
+    const __m256 t = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(i, j)), _mm256_set1_ps(G2));
+    const __m256 x0 = _mm256_sub_ps(x, _mm256_sub_ps(_mm256_cvtepi32_ps(i), t));
+    const __m256 y0 = _mm256_sub_ps(y, _mm256_sub_ps(_mm256_cvtepi32_ps(j), t));
+
+    // lower triangle (1,0) when x0 > y0, upper triangle (0,1) otherwise
+    const __m256i lower = _mm256_castps_si256(_mm256_cmp_ps(x0, y0, _CMP_GT_OQ));
+    const __m256i i1 = _mm256_and_si256(lower, _mm256_set1_epi32(1));
+    const __m256i j1 = _mm256_andnot_si256(lower, _mm256_set1_epi32(1));
+
+    const __m256 x1 = _mm256_add_ps(_mm256_sub_ps(x0, _mm256_cvtepi32_ps(i1)), _mm256_set1_ps(G2));
+    const __m256 y1 = _mm256_add_ps(_mm256_sub_ps(y0, _mm256_cvtepi32_ps(j1)), _mm256_set1_ps(G2));
+    const __m256 x2 = _mm256_add_ps(_mm256_sub_ps(x0, _mm256_set1_ps(1.0f)), _mm256_set1_ps(2.0f * G2));
+    const __m256 y2 = _mm256_add_ps(_mm256_sub_ps(y0, _mm256_set1_ps(1.0f)), _mm256_set1_ps(2.0f * G2));
+
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i gi0 = hashAVX2(_mm256_add_epi32(i, hashAVX2(j)));
+    const __m256i gi1 = hashAVX2(_mm256_add_epi32(_mm256_add_epi32(i, i1), hashAVX2(_mm256_add_epi32(j, j1))));
+    const __m256i gi2 = hashAVX2(_mm256_add_epi32(_mm256_add_epi32(i, one), hashAVX2(_mm256_add_epi32(j, one))));
+
+    const __m256 n = _mm256_add_ps(_mm256_add_ps(cornerAVX2(x0, y0, gi0), cornerAVX2(x1, y1, gi1)), cornerAVX2(x2, y2, gi2));
+    return _mm256_mul_ps(_mm256_set1_ps(45.23065f), n);
+}
+
+SIMPLEXNOISE_TARGET_AVX2 static void fractal2DAVX2(size_t octaves, float frequency, float amplitude, float lacunarity, float persistence,
+                                                   const float* xs, const float* ys, float* out, size_t n) {
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        const __m256 x = _mm256_loadu_ps(xs + k);
+        const __m256 y = _mm256_loadu_ps(ys + k);
+        __m256 output = _mm256_setzero_ps();
+        float denom = 0.f;
+        float octaveFrequency = frequency;
+        float octaveAmplitude = amplitude;
+
+        for (size_t octave = 0; octave < octaves; octave++) {
+            const __m256 f = _mm256_set1_ps(octaveFrequency);
+            const __m256 value = noiseAVX2(_mm256_mul_ps(x, f), _mm256_mul_ps(y, f));
+            output = _mm256_add_ps(output, _mm256_mul_ps(_mm256_set1_ps(octaveAmplitude), value));
+            denom += octaveAmplitude;
+
+            octaveFrequency *= lacunarity;
+            octaveAmplitude *= persistence;
+        }
+        _mm256_storeu_ps(out + k, _mm256_div_ps(output, _mm256_set1_ps(denom)));
+    }
+    fractal2DSSE41(octaves, frequency, amplitude, lacunarity, persistence, xs + k, ys + k, out + k, n - k);
+}
+
+SIMPLEXNOISE_TARGET_AVX2 static inline void cornerDerivativesAVX2(__m256 x, __m256 y, __m256i hash, __m256& n, __m256& dx, __m256& dy) {
+    const __m256i h = _mm256_and_si256(hash, _mm256_set1_epi32(0x3F));
+    const __m256 lowHash = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+    const __m256 u = _mm256_xor_ps(_mm256_set1_ps(1.0f), _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31)));
+    const __m256 v = _mm256_xor_ps(_mm256_set1_ps(2.0f), _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30)));
+    const __m256 gx = _mm256_blendv_ps(v, u, lowHash);
+    const __m256 gy = _mm256_blendv_ps(u, v, lowHash);
+
+    __m256 t = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(0.5f), _mm256_mul_ps(x, x)), _mm256_mul_ps(y, y));
+    t = _mm256_max_ps(t, _mm256_setzero_ps());
+    const __m256 t2 = _mm256_mul_ps(t, t);
+    const __m256 t4 = _mm256_mul_ps(t2, t2);
+    const __m256 g = _mm256_add_ps(_mm256_mul_ps(gx, x), _mm256_mul_ps(gy, y));
+    const __m256 m = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(-8.0f), _mm256_mul_ps(t2, t)), g);
+    n = _mm256_add_ps(n, _mm256_mul_ps(t4, g));
+    dx = _mm256_add_ps(dx, _mm256_add_ps(_mm256_mul_ps(t4, gx), _mm256_mul_ps(m, x)));
+    dy = _mm256_add_ps(dy, _mm256_add_ps(_mm256_mul_ps(t4, gy), _mm256_mul_ps(m, y)));
+}
+
+SIMPLEXNOISE_TARGET_AVX2 static inline void noiseDerivativesAVX2(__m256 x, __m256 y, __m256& n, __m256& dx, __m256& dy) {
+    const float F2 = 0.366025403f;
+    const float G2 = 0.211324865f;
+
+    const __m256 s = _mm256_mul_ps(_mm256_add_ps(x, y), _mm256_set1_ps(F2));
+    const __m256i i = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(x, s)));
+    const __m256i j = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(y, s)));
+
+    const __m256 t = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(i, j)), _mm256_set1_ps(G2));
+    const __m256 x0 = _mm256_sub_ps(x, _mm256_sub_ps(_mm256_cvtepi32_ps(i), t));
+    const __m256 y0 = _mm256_sub_ps(y, _mm256_sub_ps(_mm256_cvtepi32_ps(j), t));
+
+    const __m256i lower = _mm256_castps_si256(_mm256_cmp_ps(x0, y0, _CMP_GT_OQ));
+    const __m256i i1 = _mm256_and_si256(lower, _mm256_set1_epi32(1));
+    const __m256i j1 = _mm256_andnot_si256(lower, _mm256_set1_epi32(1));
+
+    const __m256 x1 = _mm256_add_ps(_mm256_sub_ps(x0, _mm256_cvtepi32_ps(i1)), _mm256_set1_ps(G2));
+    const __m256 y1 = _mm256_add_ps(_mm256_sub_ps(y0, _mm256_cvtepi32_ps(j1)), _mm256_set1_ps(G2));
+    const __m256 x2 = _mm256_add_ps(_mm256_sub_ps(x0, _mm256_set1_ps(1.0f)), _mm256_set1_ps(2.0f * G2));
+    const __m256 y2 = _mm256_add_ps(_mm256_sub_ps(y0, _mm256_set1_ps(1.0f)), _mm256_set1_ps(2.0f * G2));
+
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i gi0 = hashAVX2(_mm256_add_epi32(i, hashAVX2(j)));
+    const __m256i gi1 = hashAVX2(_mm256_add_epi32(_mm256_add_epi32(i, i1), hashAVX2(_mm256_add_epi32(j, j1))));
+    const __m256i gi2 = hashAVX2(_mm256_add_epi32(_mm256_add_epi32(i, one), hashAVX2(_mm256_add_epi32(j, one))));
+
+    n = _mm256_setzero_ps();
+    dx = _mm256_setzero_ps();
+    dy = _mm256_setzero_ps();
+    cornerDerivativesAVX2(x0, y0, gi0, n, dx, dy);
+    cornerDerivativesAVX2(x1, y1, gi1, n, dx, dy);
+    cornerDerivativesAVX2(x2, y2, gi2, n, dx, dy);
+    const __m256 scale = _mm256_set1_ps(45.23065f);
+    n = _mm256_mul_ps(scale, n);
+    dx = _mm256_mul_ps(scale, dx);
+    dy = _mm256_mul_ps(scale, dy);
+}
+
+SIMPLEXNOISE_TARGET_AVX2 static void fractal2DDerivativesAVX2(size_t octaves, float frequency, float amplitude, float lacunarity, float persistence,
+                                                                const float* xs, const float* ys, float* out, float* dxs, float* dys, size_t n) {
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8) {
+        const __m256 x = _mm256_loadu_ps(xs + k);
+        const __m256 y = _mm256_loadu_ps(ys + k);
+        __m256 output = _mm256_setzero_ps();
+        __m256 outputDx = _mm256_setzero_ps();
+        __m256 outputDy = _mm256_setzero_ps();
+        float denom = 0.f;
+        float octaveFrequency = frequency;
+        float octaveAmplitude = amplitude;
+
+        for (size_t octave = 0; octave < octaves; octave++) {
+            const __m256 f = _mm256_set1_ps(octaveFrequency);
+            __m256 value, dx, dy;
+            noiseDerivativesAVX2(_mm256_mul_ps(x, f), _mm256_mul_ps(y, f), value, dx, dy);
+            const __m256 a = _mm256_set1_ps(octaveAmplitude);
+            const __m256 af = _mm256_set1_ps(octaveAmplitude * octaveFrequency);
+            output = _mm256_add_ps(output, _mm256_mul_ps(a, value));
+            outputDx = _mm256_add_ps(outputDx, _mm256_mul_ps(af, dx));
+            outputDy = _mm256_add_ps(outputDy, _mm256_mul_ps(af, dy));
+            denom += octaveAmplitude;
+
+            octaveFrequency *= lacunarity;
+            octaveAmplitude *= persistence;
+        }
+        const __m256 d = _mm256_set1_ps(denom);
+        _mm256_storeu_ps(out + k, _mm256_div_ps(output, d));
+        _mm256_storeu_ps(dxs + k, _mm256_div_ps(outputDx, d));
+        _mm256_storeu_ps(dys + k, _mm256_div_ps(outputDy, d));
+    }
+    fractal2DDerivativesSSE41(octaves, frequency, amplitude, lacunarity, persistence, xs + k, ys + k, out + k, dxs + k, dys + k, n - k);
+}
+
+/**
+ * CPU feature checks, AVX2 also needs the OS to save the YMM registers
+ */
+static bool cpuHasSSE41() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 19)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+static bool cpuHasAVX2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // SIMPLEXNOISE_X86
+
+struct Fractal2DDispatch {
+    Fractal2DKernel kernel;
+    Fractal2DDerivativesKernel derivativesKernel;
+    const char* name;
+};
+
+static const Fractal2DDispatch& fractal2DDispatch() {
+    static const Fractal2DDispatch dispatch = []() -> Fractal2DDispatch {
+#if defined(SIMPLEXNOISE_X86)
+        if (cpuHasAVX2()) {
+            return { fractal2DAVX2, fractal2DDerivativesAVX2, "AVX2" };
+        }
+        if (cpuHasSSE41()) {
+            return { fractal2DSSE41, fractal2DDerivativesSSE41, "SSE4.1" };
+        }
+#endif
+        return { fractal2DScalar, fractal2DDerivativesScalar, "scalar" };
+    }();
+    return dispatch;
+}
+
+/**
+ * Batched Fractal/Fractional Brownian Motion (fBm) summation of 2D Perlin Simplex noise
+ *
+ * @param[in] octaves   number of fraction of noise to sum
+ * @param[in] xs        n x float coordinates
+ * @param[in] ys        n y float coordinates
+ * @param[out] out      n noise values in the range[-1; 1]
+ * @param[in] n         number of points
+ */
+void SimplexNoise::fractal2D(size_t octaves, const float* xs, const float* ys, float* out, size_t n) const {
+    fractal2DDispatch().kernel(octaves, mFrequency, mAmplitude, mLacunarity, mPersistence, xs, ys, out, n);
+}
+
+/**
+ * Batched Fractal/Fractional Brownian Motion (fBm) summation of 2D Perlin Simplex noise over a regular grid
+ *
+ * @param[in] octaves   number of fraction of noise to sum
+ * @param[in] x0        x float coordinate of the first sample
+ * @param[in] y0        y float coordinate of the first sample
+ * @param[in] step      distance between neighbouring samples
+ * @param[in] countX    number of samples along x
+ * @param[in] countY    number of samples along y
+ * @param[out] out      countX * countY noise values, out[i * countY + j] is the sample at (x0 + i * step, y0 + j * step)
+ */
+void SimplexNoise::fractal2DGrid(size_t octaves, float x0, float y0, float step, size_t countX, size_t countY, float* out) const {
+    const size_t BLOCK = 256;
+    float xs[BLOCK];
+    float ys[BLOCK];
+
+    for (size_t i = 0; i < countX; i++) {
+        const float x = x0 + i * step;
+        for (size_t start = 0; start < countY; start += BLOCK) {
+            const size_t count = (countY - start < BLOCK) ? (countY - start) : BLOCK;
+            for (size_t j = 0; j < count; j++) {
+                xs[j] = x;
+                ys[j] = y0 + (start + j) * step;
+            }
+            fractal2D(octaves, xs, ys, out + i * countY + start, count);
+        }
+    }
+}
+
+/**
+ * Batched fBm of 2D Perlin Simplex noise over a regular grid with its analytic derivatives
+ *
+ * @param[in] octaves   number of fraction of noise to sum
+ * @param[in] x0        x float coordinate of the first sample
+ * @param[in] y0        y float coordinate of the first sample
+ * @param[in] step      distance between neighbouring samples
+ * @param[in] countX    number of samples along x
+ * @param[in] countY    number of samples along y
+ * @param[out] out      countX * countY noise values laid out as fractal2DGrid does
+ * @param[out] dxs      derivatives along x, same layout
+ * @param[out] dys      derivatives along y, same layout
+ */
+void SimplexNoise::fractal2DGridWithDerivatives(size_t octaves, float x0, float y0, float step, size_t countX, size_t countY,
+                                                float* out, float* dxs, float* dys) const {
+    const size_t BLOCK = 256;
+    float xs[BLOCK];
+    float ys[BLOCK];
+    const Fractal2DDerivativesKernel kernel = fractal2DDispatch().derivativesKernel;
+
+    for (size_t i = 0; i < countX; i++) {
+        const float x = x0 + i * step;
+        for (size_t start = 0; start < countY; start += BLOCK) {
+            const size_t count = (countY - start < BLOCK) ? (countY - start) : BLOCK;
+            for (size_t j = 0; j < count; j++) {
+                xs[j] = x;
+                ys[j] = y0 + (start + j) * step;
+            }
+            const size_t offset = i * countY + start;
+            kernel(octaves, mFrequency, mAmplitude, mLacunarity, mPersistence, xs, ys, out + offset, dxs + offset, dys + offset, count);
+        }
+    }
+}
+
+/**
+ * @return name of the batch kernel used on this CPU
+ */
+const char* SimplexNoise::batchKernelName() {
+    return fractal2DDispatch().name;
+}
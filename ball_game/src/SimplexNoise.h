@@ -29,6 +29,27 @@ public:
     float fractal(size_t octaves, float x, float y) const;
     float fractal(size_t octaves, float x, float y, float z) const;
 
+    // Batched 2D fBm, out[k] = fractal(octaves, xs[k], ys[k]), using AVX2 or SSE4.1 kernels when the CPU has them
+    void fractal2D(size_t octaves, const float* xs, const float* ys, float* out, size_t n) const;
+    // Batched 2D fBm over a regular grid, out[i * countY + j] = fractal(octaves, x0 + i * step, y0 + j * step)
+    void fractal2DGrid(size_t octaves, float x0, float y0, float step, size_t countX, size_t countY, float* out) const;
+    // Name of the batch kernel picked for this CPU ("AVX2", "SSE4.1" or "scalar")
+    static const char* batchKernelName();
+
+    // Noise value along with its analytic partial derivatives d/dx and d/dy
+    struct Derivatives {
+        float value;
+        float dx;
+        float dy;
+    };
+    // 2D Perlin simplex noise and its gradient, value is the same as noise(x, y)
+    static Derivatives noiseWithDerivatives(float x, float y);
+    // 2D fBm and its gradient, value is the same as fractal(octaves, x, y)
+    Derivatives fractalWithDerivatives(size_t octaves, float x, float y) const;
+    // fractal2DGrid that also writes the gradient, dxs[i * countY + j] and dys[i * countY + j]
+    void fractal2DGridWithDerivatives(size_t octaves, float x0, float y0, float step, size_t countX, size_t countY,
+                                      float* out, float* dxs, float* dys) const;
+
     /**
      * Constructor of to initialize a fractal noise summation
      *
@@ -8,6 +8,13 @@
 #include "shader.h"
 #include "camera.h"
 #include "terrain.h"
+#include "terrainrenderer.h"
+#include "farfield.h"
+#include "profiler.h"
+#include "glcounters.h"
+#include "benchmark.h"
+#include "memorystats.h"
+#include "trace.h"
 #include "player.h"
 
 #include "SimplexNoise.h"
@@ -19,6 +26,9 @@
 #include <vector>
 #include <random>
 #include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <chrono>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -27,11 +37,20 @@ const int SCR_WIDTH = 800;
 const int SCR_HEIGHT = 600;
 const float chunkHeight = 75.0f;
 const float waterLevel = (chunkHeight * 0.4f) - chunkHeight; // If chunkmap.frag's water level is changed from 0.2f adjust this value
-const float VIEW_DISTANCE = 1000.0f;
+const float VIEW_DISTANCE = 1000.0f; // far plane of everything but the far field, past the chunk window's corners
+const float NEAR_PLANE = 0.5f;
+const float FAR_FIELD_DEPTH_SPLIT = 0.5f; // the far field gets the depth range from here to 1, everything else the rest
 const int CHUNK_MAP_SIZE = 20;
+const int FAR_FIELD_RADIUS = 60; // in chunks, low resolution terrain out to the horizon past CHUNK_MAP_SIZE
 const int chunkResolution = 1;
 const unsigned int TEXTURE_SIZE = 10;
 const int CHUNK_SIZE = 50;
+const Terrain_Mesh_Mode TERRAIN_MESH_MODE = SHARED_VERTEX; // FLAT_SHADED for the old faceted look, HEIGHTMAP_GRID keeps only heights on the GPU, TESSELLATED_PATCHES needs GL 4.1
+const Terrain_Vertex_Format TERRAIN_VERTEX_FORMAT = PACKED_VERTEX; // 8 byte vertices, FLOAT_VERTEX for 32 byte ones
+const Terrain_Height_Source TERRAIN_HEIGHT_SOURCE = CPU_HEIGHTFIELD; // GPU_HEIGHTFIELD runs heightmap.glsl for TESSELLATED_PATCHES, needs GL 4.3
+const bool TERRAIN_GPU_PARITY_CHECK = false; // compares every GPU heightfield with the CPU noise, slow
+const size_t TERRAIN_CPU_BUDGET_MB = 64; // chunks past the visible window are evicted beyond these, 0 for no limit
+const size_t TERRAIN_GPU_BUDGET_MB = 64;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 float lastX = SCR_WIDTH / 2;
@@ -45,26 +64,46 @@ glm::vec3 lightPosition(lightPosition_x, lightPosition_y, lightPosition_z);
 
 bool qPressed = false;
 bool tPressed = false;
+bool f9Pressed = false;
+std::string traceFile = "trace.json";
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void updateLastFrame(void);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void processInput(GLFWwindow* window);
-void terrainBufferWriter(std::vector<GLuint> *terrainVAOs, std::vector<GLuint> *terrainVBOs, std::vector<GLuint> *terrainEBOs, terrainChunk *chunk);
 void clearBuffer(unsigned int VAO, unsigned int VBO, unsigned int EBO);
 unsigned int loadCubemap(std::vector<std::string> faces);
+unsigned char* loadImage(const char* path, int* width, int* height, int* channels);
+void freeImage(unsigned char* data, int width, int height, int channels);
 
-int main(void)
+int main(int argc, char** argv)
 {
+    // --benchmark flies a camera path at a fixed timestep in a hidden window and writes a report, see benchmark.h
+    benchmarkSettings benchmark;
+    CameraPath cameraPath;
+    if (!benchmarkSettings::fromArguments(argc, argv, &benchmark) || (benchmark.enabled && !cameraPath.load(benchmark.pathFile))) {
+        return -1;
+    }
+    // F9 starts a fresh trace and F9 again stops it and writes it, a trace still running at exit is written then
+    Tracer::instance().setThreadName("render");
+    if (!benchmark.traceFile.empty()) {
+        traceFile = benchmark.traceFile;
+        Tracer::instance().setEnabled(true);
+    }
+
     // Initialize and configure library
     //glfwInit();
     if (!glfwInit()) {
         std::cout << "Failed to initialize GLFW" << std::endl;
         return -1;
     }
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    // tessellation shaders need 4.0, 4.1 is as far as macOS goes, compute shaders need 4.3
+    bool gpuHeightfields = TERRAIN_MESH_MODE == TESSELLATED_PATCHES && TERRAIN_HEIGHT_SOURCE == GPU_HEIGHTFIELD;
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, TERRAIN_MESH_MODE == TESSELLATED_PATCHES ? 4 : 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, gpuHeightfields ? 3 : TERRAIN_MESH_MODE == TESSELLATED_PATCHES ? 1 : 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    // nothing looks at a benchmark, it still needs a window system (Xvfb on headless Linux) for the context
+    glfwWindowHint(GLFW_VISIBLE, benchmark.enabled ? GLFW_FALSE : GLFW_TRUE);
 
     // Create a windowed mode window and its OpenGL context
     GLFWwindow* window;
@@ -84,6 +123,8 @@ int main(void)
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    // counts draws, binds, uniforms and upload bytes per frame and per profiler section from here on
+    glCallCounters().install();
 
     // initialize imgui
     IMGUI_CHECKVERSION();
@@ -101,9 +142,9 @@ int main(void)
     // shaders
     Shader lightingShader("../ball_game/src/colors.vs", "../ball_game/src/colors.fs");
     Shader lightCubeShader("../ball_game/src/light_cube.vs", "../ball_game/src/light_cube.fs");
-    Shader chunkMapShader("../ball_game/src/chunkmap.vert", "../ball_game/src/chunkmap.frag");
     Shader skyBoxShader("../ball_game/src/skybox.vert", "../ball_game/src/skybox.frag");
     Shader waterShader("../ball_game/src/water.vert", "../ball_game/src/water.frag");
+    Shader farFieldShader("../ball_game/src/farfield.vert", "../ball_game/src/farfield.frag");
 
     GLfloat verticesLightCube[] = {
     -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
@@ -252,31 +293,74 @@ int main(void)
     float persistance = 0.3f; // 0.5f
     int octaves = 7; // 5
     // initialize terrain
-    Terrain terrainMap(chunkHeight, chunkResolution, lacunarity, persistance, octaves, CHUNK_MAP_SIZE, CHUNK_SIZE);
+    Terrain terrainMap(chunkHeight, chunkResolution, lacunarity, persistance, octaves, CHUNK_MAP_SIZE, CHUNK_SIZE, TERRAIN_MESH_MODE, TERRAIN_VERTEX_FORMAT, 0, TERRAIN_HEIGHT_SOURCE);
+    terrainMap.setMemoryBudget(TERRAIN_CPU_BUDGET_MB * 1024 * 1024, TERRAIN_GPU_BUDGET_MB * 1024 * 1024);
+    // the heightmap renderers need a texture array layer per slot, GL 3.3 only promises 256
+    if ((terrainMap.meshMode == TESSELLATED_PATCHES || terrainMap.meshMode == HEIGHTMAP_GRID)
+        && TerrainRenderer::maxTextureLayers() < terrainMap.maxBufferedChunks()) {
+        std::cout << "ERROR TERRAIN NEEDS " << terrainMap.maxBufferedChunks() << " TEXTURE ARRAY LAYERS, THE GPU HAS "
+            << TerrainRenderer::maxTextureLayers() << ", FALLING BACK TO SHARED_VERTEX" << std::endl;
+        terrainMap.setMeshMode(SHARED_VERTEX);
+    }
+    if (!benchmark.diskCacheDirectory.empty()) {
+        terrainMap.enableDiskCache(benchmark.diskCacheDirectory);
+    }
+    std::unique_ptr<HeightmapCompute> heightmapCompute;
+    if (terrainMap.heightSource == GPU_HEIGHTFIELD) {
+        heightmapCompute.reset(new HeightmapCompute(terrainMap, "../ball_game/src/heightmap.glsl", "../ball_game/src/normalmap.glsl"));
+        if (TERRAIN_GPU_PARITY_CHECK) {
+            heightmapCompute->enableParityCheck(0.001f * chunkHeight);
+        }
+    }
+    std::unique_ptr<TerrainRenderer> terrainRenderer;
+    if (terrainMap.meshMode == TESSELLATED_PATCHES) {
+        terrainRenderer.reset(new TerrainPatchRenderer(terrainMap.maxBufferedChunks(), terrainMap.heightfieldSize(), terrainMap.heightfieldSpacing(), CHUNK_SIZE, heightmapCompute.get()));
+    }
+    else if (terrainMap.meshMode == HEIGHTMAP_GRID) {
+        terrainRenderer.reset(new TerrainGridRenderer(terrainMap.maxBufferedChunks(), terrainMap.heightfieldSize(), terrainMap.lodIndexLists()));
+    }
+    else {
+        terrainRenderer.reset(new TerrainGeometryPool(terrainMap.maxBufferedChunks(), terrainMap.maxChunkVertices(), terrainMap.maxChunkIndices(), terrainMap.lodIndexLists(), TERRAIN_VERTEX_FORMAT));
+    }
+    Shader chunkMapShader = terrainMap.meshMode == TESSELLATED_PATCHES
+        ? Shader("../ball_game/src/chunkmap.vs", "../ball_game/src/chunkmap.tcs", "../ball_game/src/chunkmap.tes", "../ball_game/src/chunkmap.frag")
+        : Shader("../ball_game/src/chunkmap.vert", "../ball_game/src/chunkmap.frag");
+    FarField farField(terrainMap, FAR_FIELD_RADIUS, CHUNK_MAP_SIZE / 2); // the hole lines up with checkForVisibleChunks' window
+
+    // level of detail settings don't change after the terrain is built
+    chunkMapShader.use();
+    chunkMapShader.setInt("verticesPerSide", CHUNK_SIZE / chunkResolution + 1);
+    chunkMapShader.setInt("lodLevels", terrainMap.lodLevelCount());
+    for (int level = 0; level < terrainMap.lodLevelCount(); level++) {
+        std::string index = "[" + std::to_string(level) + "]";
+        chunkMapShader.setInt("lodStrides" + index, terrainMap.lodStride(level));
+        chunkMapShader.setVec2("lodMorphRanges" + index, terrainMap.lodMorphStart(level), terrainMap.lodMorphEnd(level));
+    }
 
     // vao[1] and vbo[2] for plane mesh/terrain ... should probably give it a unique named variable
-    unsigned int VAOs[2], VBOs[2], lightVAO, lightVBO, skyboxVAO, skyboxVBO, waterPlaneVAO, waterPlaneVBO;
-    
-    // creating buffers for every chunk
-    std::vector<GLuint> terrainVAOs;
-    std::vector<GLuint> terrainVBOs;
-    std::vector<GLuint> terrainEBOs;
+    unsigned int VAOs[2], VBOs[2], lightVAO, lightVBO, skyboxVAO, skyboxVBO, waterPlaneVAO, waterPlaneVBO, waterInstanceVBO;
 
     // skybox buffer
     glGenVertexArrays(1, &skyboxVAO);
     glGenBuffers(1, &skyboxVBO);
+    memoryStats().created(GPU_VERTEX_ARRAY, 1);
+    memoryStats().created(GPU_BUFFER, 1);
     glBindVertexArray(skyboxVAO);
     glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
+    memoryStats().allocated(GPU_BUFFER, skyboxVBO, "skybox vertices", sizeof(skyboxVertices));
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
 
     // water plane buffer ----------------------------------------------------------------
     glGenVertexArrays(1, &waterPlaneVAO);
     glGenBuffers(1, &waterPlaneVBO);
+    memoryStats().created(GPU_VERTEX_ARRAY, 1);
+    memoryStats().created(GPU_BUFFER, 1);
     glBindVertexArray(waterPlaneVAO);
     glBindBuffer(GL_ARRAY_BUFFER, waterPlaneVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(waterPlaneVertices), waterPlaneVertices, GL_STATIC_DRAW);
+    memoryStats().allocated(GPU_BUFFER, waterPlaneVBO, "water plane vertices", sizeof(waterPlaneVertices));
 
     // verticies
     glEnableVertexAttribArray(0);
@@ -286,11 +370,23 @@ int main(void)
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
 
+    // chunk positions, one instance per chunk with water
+    glGenBuffers(1, &waterInstanceVBO);
+    memoryStats().created(GPU_BUFFER, 1);
+    glBindBuffer(GL_ARRAY_BUFFER, waterInstanceVBO);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glVertexAttribDivisor(2, 1);
+    std::vector<float> waterInstances;
+
     // cube stuff -----------------------------------------------------------------------
     glGenVertexArrays(2, VAOs);
     glGenBuffers(2, VBOs);
+    memoryStats().created(GPU_VERTEX_ARRAY, 2);
+    memoryStats().created(GPU_BUFFER, 2);
     glBindBuffer(GL_ARRAY_BUFFER, VBOs[0]);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    memoryStats().allocated(GPU_BUFFER, VBOs[0], "cube vertices", sizeof(vertices));
 
     glBindVertexArray(VAOs[0]);
 
@@ -310,9 +406,12 @@ int main(void)
     glGenVertexArrays(1, &lightVAO);
     glBindVertexArray(lightVAO);
     glGenBuffers(1, &lightVBO);
+    memoryStats().created(GPU_VERTEX_ARRAY, 1);
+    memoryStats().created(GPU_BUFFER, 1);
     glBindBuffer(GL_ARRAY_BUFFER, lightVBO);
     // position attribute
     glBufferData(GL_ARRAY_BUFFER, sizeof(verticesLightCube), verticesLightCube, GL_STATIC_DRAW);
+    memoryStats().allocated(GPU_BUFFER, lightVBO, "light cube vertices", sizeof(verticesLightCube));
     glEnableVertexAttribArray(0);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
@@ -321,6 +420,7 @@ int main(void)
     // can use glgentextures to generate more than one texture at a time 
     unsigned int brick, grass;
     glGenTextures(1, &brick);
+    memoryStats().created(GPU_TEXTURE, 1);
     glBindTexture(GL_TEXTURE_2D, brick);
 
     // texture wrapping/filtering options for current texture(s)
@@ -331,20 +431,23 @@ int main(void)
 
     // load brick texture
     int width, height, nrChannels;
-    unsigned char* data = stbi_load("../ball_game/src/wall.jpg", &width, &height, &nrChannels, 0);
+    unsigned char* data = loadImage("../ball_game/src/wall.jpg", &width, &height, &nrChannels);
     
     if (data) {
+        TRACE_SCOPE("upload texture");
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);
+        memoryStats().allocated(GPU_TEXTURE, brick, "brick", MemoryStats::textureBytes(width, height, 1, 3, true));
     }
     else {
         std::cout << "Failed to load texture: brick " << std::endl;
     }
     // Done loading texture so free data
-    stbi_image_free(data);
+    freeImage(data, width, height, nrChannels);
 
     // ---- load grass texture
     glGenTextures(1, &grass);
+    memoryStats().created(GPU_TEXTURE, 1);
     glBindTexture(GL_TEXTURE_2D, grass);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -352,17 +455,19 @@ int main(void)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-    data = stbi_load("../ball_game/src/grass.jpg", &width, &height, &nrChannels, 0);
+    data = loadImage("../ball_game/src/grass.jpg", &width, &height, &nrChannels);
 
     if (data) {
+        TRACE_SCOPE("upload texture");
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);
+        memoryStats().allocated(GPU_TEXTURE, grass, "grass", MemoryStats::textureBytes(width, height, 1, 3, true));
     }
     else {
         std::cout << "Failed to load texture: grass " << std::endl;
     }
     // Done loading texture so free data
-    stbi_image_free(data);
+    freeImage(data, width, height, nrChannels);
 
     // Load skybox into memory buffer
     std::vector<std::string> faces
@@ -385,25 +490,67 @@ int main(void)
 
     glEnable(GL_DEPTH_TEST);
 
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    if (benchmark.enabled) {
+        mouseLook = false;
+    }
+    else {
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    }
 
     // just stuff for the imgui thing, move it later
     bool show_demo_window = false;
 
     glm::vec3 lightColor = glm::vec3(1.0f, 1.0f, 1.0f);
-    std::pair<int, int> lastChunk = terrainMap.currentChunk;
-    std::vector<std::pair<int, int>> lastChunkList;
-    bool generatedFirstChunk = false;
+
+    // passes shown in the profiler, generation is the worker threads' time added up
+    FrameProfiler profiler;
+    const int PROFILE_FRAME = profiler.addSection("frame", false);
+    const int PROFILE_VISIBILITY = profiler.addSection("chunk visibility", false);
+    const int PROFILE_GENERATION = profiler.addSection("generation", false);
+    const int PROFILE_UPLOADS = profiler.addSection("uploads", true);
+    const int PROFILE_TERRAIN = profiler.addSection("terrain draw", true);
+    const int PROFILE_WATER = profiler.addSection("water", true);
+    const int PROFILE_FAR_FIELD = profiler.addSection("far field", true);
+    const int PROFILE_CUBES = profiler.addSection("cubes", true);
+    const int PROFILE_SKYBOX = profiler.addSection("skybox", true);
+    const int PROFILE_IMGUI = profiler.addSection("imgui", true);
+
+    BenchmarkReport benchmarkReport;
+    int benchmarkFrame = 0;
+    double benchmarkGenerationMilliseconds = 0.0;
 
     /* -------Loop until the user closes the window------------ */
-    while (!glfwWindowShouldClose(window))
+    while (!glfwWindowShouldClose(window) && !(benchmark.enabled && benchmarkFrame == benchmark.frames))
     {
-        updateLastFrame();
+        if (benchmark.enabled) {
+            // everything requested last frame is collected this frame however the threads were scheduled,
+            // so every run sees the same chunks on the same frame. The wait isn't part of the frame time.
+            terrainMap.waitForGeneration();
+        }
+        std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+
+        profiler.beginFrame();
+        profiler.begin(PROFILE_FRAME);
+        double generationMilliseconds = terrainMap.takeGenerationMilliseconds();
+        profiler.addCpuTime(PROFILE_GENERATION, generationMilliseconds);
+        if (benchmark.enabled) {
+            deltaTime = benchmark.timestep;
+            lastFrame = benchmarkFrame * benchmark.timestep;
+        }
+        else {
+            updateLastFrame();
+        }
+        float sceneTime = benchmark.enabled ? lastFrame : (float)glfwGetTime();
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame(); 
 
-        processInput(window);
+        if (benchmark.enabled) {
+            cameraPath.apply(camera, sceneTime);
+        }
+        else {
+            processInput(window);
+        }
 
         // 1. Show the big demo window (Most of the sample code is in ImGui::ShowDemoWindow()! You can browse its code to learn more about Dear ImGui!).
         if (show_demo_window)
@@ -423,9 +570,27 @@ int main(void)
 
             ImGui::Text("Position: x = %.1f, y = %.1f, z = %.1f", camera.Position.x, camera.Position.y, camera.Position.z);
             ImGui::Text("Front: x = %.1f, y = %.1f, z = %.1f", camera.Front.x, camera.Front.y, camera.Front.z);
+            ImGui::Text("Ground height below camera: %.1f", terrainMap.heightAt(camera.Position.x, camera.Position.z));
             ImGui::Text("Chunk Map Position: x = %i, z = %i", terrainMap.currentChunk.first, terrainMap.currentChunk.second);
+            ImGui::Text("Chunks generated: %i, queued: %i, culled: %i", terrainMap.chunksGenerated, terrainMap.queuedChunks(), terrainMap.culledChunkCount());
+            ImGui::Text("Terrain triangles: %i, far field: %i", terrainMap.drawnTriangleCount(), farField.triangleCount());
+            ImGui::Text("Chunks resident: %i, CPU %.1f MB, GPU %.1f MB%s", terrainMap.residentChunks(),
+                terrainMap.residentCpuBytes() / (1024.0f * 1024.0f), terrainMap.residentGpuBytes() / (1024.0f * 1024.0f),
+                terrainMap.overBudget() ? " (over budget)" : "");
+            if (terrainMap.getDiskCache() != nullptr) {
+                ImGui::Text("Disk cache: hits %i, misses %i, regions mapped %i", terrainMap.getDiskCache()->hits(),
+                    terrainMap.getDiskCache()->misses(), terrainMap.getDiskCache()->openRegions());
+            }
+            ImGui::Text("Uploaded last frame: %i chunks, %.1f KB, geometry slots free: %i / %i", terrainRenderer->uploadedChunks(),
+                terrainRenderer->uploadedBytes() / 1024.0f, terrainRenderer->freeSlotCount(), terrainRenderer->getSlotCount());
+            if (heightmapCompute) {
+                ImGui::Text("GPU heightfields: %i, parity max error %.5f, failures %i", heightmapCompute->generatedChunks(),
+                    heightmapCompute->maxParityError(), heightmapCompute->parityFailures());
+            }
 
             ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
+            profiler.drawOverlay();
+            memoryStats().drawOverlay();
             ImGui::End();
         }
 
@@ -434,6 +599,7 @@ int main(void)
 
         // Render here
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glDepthRange(0.0, FAR_FIELD_DEPTH_SPLIT);
 
         lightingShader.use();
         lightingShader.setVec3("objectColor", 1.0f, 0.5f, 0.31f);
@@ -442,40 +608,66 @@ int main(void)
         lightingShader.setVec3("viewPosition", lightPosition);
 
         // projection/view matrix
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Fov), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, VIEW_DISTANCE);
+        // One projection out to the horizon would need a 0.1 to 4500 depth ratio and the water z-fights the terrain
+        // halfway out. The far field is drawn with its own projection into the back of the depth range instead, it's
+        // never in front of a chunk, and starts at half the hole's distance, inside anything the view can see of it.
+        float aspect = (float)SCR_WIDTH / (float)SCR_HEIGHT;
+        glm::mat4 projection = glm::perspective(glm::radians(camera.Fov), aspect, NEAR_PLANE, VIEW_DISTANCE);
+        glm::mat4 farFieldProjection = glm::perspective(glm::radians(camera.Fov), aspect, farField.holeReach() * 0.5f, farField.reach() * 1.5f);
         glm::mat4 view = camera.GetViewMatrix();
         lightingShader.setMat4("projection", projection);
         lightingShader.setMat4("view", view);
 
         //bind brick texture for boxes
+        profiler.begin(PROFILE_CUBES);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, brick);
 
         // draw first box
         glm::mat4 model = glm::mat4(1.0f);
-        model = glm::rotate(model, (float)glfwGetTime() * glm::radians(50.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::translate(model,  glm::vec3(4*cos((float)glfwGetTime() * 2.0f), 0.0f, 4*sin((float)glfwGetTime() * 2.0f)));
+        model = glm::rotate(model, sceneTime * glm::radians(50.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        model = glm::translate(model,  glm::vec3(4*cos(sceneTime * 2.0f), 0.0f, 4*sin(sceneTime * 2.0f)));
         lightingShader.setMat4("model", model);
         glBindVertexArray(VAOs[0]);
         glDrawArrays(GL_TRIANGLES, 0, 36);
 
         // draw second box
         model = glm::mat4(1.0f);
-        model = glm::rotate(model, (float)glfwGetTime() * glm::radians(50.0f), glm::vec3(1.0f, 0.0f, 1.0f));
-        model = glm::translate(model, glm::vec3(0.0f, 5 * cos((float)glfwGetTime() * 1.0f), 5 * sin((float)glfwGetTime() * 1.0f)));
+        model = glm::rotate(model, sceneTime * glm::radians(50.0f), glm::vec3(1.0f, 0.0f, 1.0f));
+        model = glm::translate(model, glm::vec3(0.0f, 5 * cos(sceneTime * 1.0f), 5 * sin(sceneTime * 1.0f)));
         lightingShader.setMat4("model", model);
         glBindVertexArray(VAOs[0]);
         glDrawArrays(GL_TRIANGLES, 0, 36);
+        profiler.end(PROFILE_CUBES);
 
         // bind grass for terrain
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, grass);
 
 
-        // Vector of x, z pairs to be used to get chunks to be drawn
-        std::vector<std::pair<int, int>> chunksToDraw;
-        chunksToDraw = terrainMap.checkForVisibleChunks(CHUNK_MAP_SIZE, camera.Position.x, camera.Position.z, camera.Front);
+        // Chunks to be drawn this frame, pointers into terrainMap.chunkMap
+        profiler.begin(PROFILE_VISIBILITY);
+        const std::vector<terrainChunk*>& chunksToDraw = terrainMap.checkForVisibleChunks(CHUNK_MAP_SIZE, camera.Position.x, camera.Position.z, camera.GetFrustum(projection));
+        profiler.end(PROFILE_VISIBILITY);
+
+        // chunks the terrain couldn't keep for reuse still hold a geometry slot
+        profiler.begin(PROFILE_UPLOADS);
+        for (terrainChunk& evicted : terrainMap.takeEvictedChunks()) {
+            terrainRenderer->release(&evicted);
+        }
+
+        // chunks come back from the generator threads in any order, only ones that arrived since last frame are uploaded
+        terrainRenderer->uploadPending(chunksToDraw);
+        profiler.end(PROFILE_UPLOADS);
+
+        const chunkMemoryUse& chunkMemory = terrainMap.residentCpuUse();
+        memoryStats().setCpuBytes(CPU_CHUNK_VERTICES, chunkMemory.vertices);
+        memoryStats().setCpuBytes(CPU_CHUNK_INDICES, chunkMemory.indices);
+        memoryStats().setCpuBytes(CPU_CHUNK_HEIGHTFIELDS, chunkMemory.heightfields);
+        memoryStats().setCpuBytes(CPU_CHUNK_RECORDS, chunkMemory.records);
+        memoryStats().setCpuBytes(CPU_MAPPED_CACHE, terrainMap.getDiskCache() != nullptr ? terrainMap.getDiskCache()->mappedBytes() : 0);
         
+        profiler.begin(PROFILE_TERRAIN);
         chunkMapShader.use();
         chunkMapShader.setVec3("objectColor", 1.0f, 0.5f, 0.31f);
         chunkMapShader.setVec3("lightColor", lightColor);
@@ -484,86 +676,60 @@ int main(void)
         chunkMapShader.setMat4("projection", projection);
         chunkMapShader.setMat4("view", view);
         chunkMapShader.setFloat("mapHeight", chunkHeight); // Passes in the height of the chunkmap to the shader for colors
+        chunkMapShader.setBool("packedVertices", TERRAIN_VERTEX_FORMAT == PACKED_VERTEX);
+        chunkMapShader.setFloat("gridSpacing", (float)chunkResolution);
+        chunkMapShader.setFloat("textureSize", (float)TEXTURE_SIZE);
+        chunkMapShader.setVec3("cameraPosition", camera.Position);
+        terrainRenderer->setUniforms(chunkMapShader);
 
-        // draw terrain
-        for (int i = 0; i < chunksToDraw.size(); i++) {
-            if (!generatedFirstChunk) {
-                terrainChunk* chunk = &terrainMap.chunkMap[chunksToDraw[i]];
-                terrainBufferWriter(&terrainVAOs, &terrainVBOs, &terrainEBOs, chunk);
-
-                model = glm::mat4(1.0f);
-                model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
-                chunkMapShader.setMat4("model", model);
-                glBindVertexArray(terrainVAOs[i]);
-                glBindBuffer(GL_ARRAY_BUFFER, terrainVBOs[i]);
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrainEBOs[i]);
-
-                for (unsigned int strip = 0; strip <= chunk->numStrips; strip++) {
-                    glDrawElements(GL_TRIANGLE_STRIP, chunk->numVertsPerStrip, GL_UNSIGNED_INT, (void*)(sizeof(unsigned int) * chunk->numVertsPerStrip * strip));
-                }
-
-                if (chunk->hasWater) {
-                    waterShader.use();
-                    waterShader.setVec3("objectColor", 1.0f, 0.5f, 0.31f);
-                    waterShader.setVec3("lightColor", lightColor);
-                    waterShader.setVec3("lightPosition", lightPosition);
-                    waterShader.setVec3("viewPosition", lightPosition);
-                    waterShader.setMat4("projection", projection);
-                    waterShader.setMat4("view", view);
-                    
-					glBindVertexArray(waterPlaneVAO);
-					glBindBuffer(GL_ARRAY_BUFFER, waterPlaneVBO);
-					model = glm::mat4(1.0f);
-					model = glm::translate(model, glm::vec3(chunk->posX, 0.0f, chunk->posZ));
-                    waterShader.setMat4("model", model);
-					glDrawArrays(GL_TRIANGLES, 0, 6);
-				}
-            } 
-            else {
-                chunkMapShader.use();
-                terrainChunk* chunk = &terrainMap.chunkMap[chunksToDraw[i]];
-                model = glm::mat4(1.0f);
-                model = glm::translate(model, glm::vec3(0.0f, 0.0f ,0.0f));
-                lightingShader.setMat4("model", model);
-
-                glBindVertexArray(terrainVAOs[i]);
-
-                // changes the buffers only if its a new chunk, currently rewrites every chunk, should change this so it only does it for new chunks FIX IT
-                if (lastChunk.first != terrainMap.currentChunk.first || lastChunk.second != terrainMap.currentChunk.second) {
-                    if (std::find(lastChunkList.begin(), lastChunkList.end(), chunk->chunkMapCoords) == lastChunkList.end()) {
-                        glBindBuffer(GL_ARRAY_BUFFER, terrainVBOs[i]);
-                        glBufferData(GL_ARRAY_BUFFER, chunk->vertices.size() * sizeof(float), &chunk->vertices[0], GL_STATIC_DRAW);
-
-                        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrainEBOs[i]);
-                        glBufferData(GL_ELEMENT_ARRAY_BUFFER, chunk->indices.size() * sizeof(unsigned int), &chunk->indices[0], GL_STATIC_DRAW);
-                        //std::cout << "Drawing terrain chunk: " << chunk->chunkID << std::endl;
-                    }
-                }
-
-                for (unsigned int strip = 0; strip <= chunk->numStrips; strip++) {
-                    glDrawElements(GL_TRIANGLE_STRIP, chunk->numVertsPerStrip, GL_UNSIGNED_INT, (void*)(sizeof(unsigned int) * chunk->numVertsPerStrip * strip));
-                }
-                if (chunk->hasWater) {
-                    waterShader.use();
-                    waterShader.setVec3("objectColor", 1.0f, 0.5f, 0.31f);
-                    waterShader.setVec3("lightColor", lightColor);
-                    waterShader.setVec3("lightPosition", lightPosition);
-                    waterShader.setVec3("viewPosition", lightPosition);
-                    waterShader.setMat4("projection", projection);
-                    waterShader.setMat4("view", view);
-
-                    glBindVertexArray(waterPlaneVAO);
-                    glBindBuffer(GL_ARRAY_BUFFER, waterPlaneVBO);
-                    model = glm::mat4(1.0f);
-                    model = glm::translate(model, glm::vec3(chunk->posX, 0.0f, chunk->posZ));
-                    waterShader.setMat4("model", model);
-                    glDrawArrays(GL_TRIANGLES, 0, 6);
-                }
+        // draw terrain, every chunk in one multi-draw, or one instanced draw of patches
+        model = glm::mat4(1.0f);
+        chunkMapShader.setMat4("model", model);
+        terrainRenderer->drawBatch(chunksToDraw);
+        profiler.end(PROFILE_TERRAIN);
+
+        // draw water, one instanced draw over the chunks that have any
+        profiler.begin(PROFILE_WATER);
+        waterInstances.clear();
+        for (const terrainChunk* chunk : chunksToDraw) {
+            if (chunk->buffered && chunk->hasWater) {
+                waterInstances.push_back((float)chunk->posX);
+                waterInstances.push_back((float)chunk->posZ);
             }
         }
-        generatedFirstChunk = true;
+        if (!waterInstances.empty()) {
+            waterShader.use();
+            waterShader.setVec3("objectColor", 1.0f, 0.5f, 0.31f);
+            waterShader.setVec3("lightColor", lightColor);
+            waterShader.setVec3("lightPosition", lightPosition);
+            waterShader.setVec3("viewPosition", lightPosition);
+            waterShader.setMat4("projection", projection);
+            waterShader.setMat4("view", view);
+            waterShader.setMat4("model", model);
+
+            glBindVertexArray(waterPlaneVAO);
+            glBindBuffer(GL_ARRAY_BUFFER, waterInstanceVBO);
+            glBufferData(GL_ARRAY_BUFFER, waterInstances.size() * sizeof(float), waterInstances.data(), GL_STREAM_DRAW);
+            memoryStats().allocated(GPU_BUFFER, waterInstanceVBO, "water instances", waterInstances.size() * sizeof(float));
+            glDrawArraysInstanced(GL_TRIANGLES, 0, 6, (GLsizei)(waterInstances.size() / 2));
+        }
+        profiler.end(PROFILE_WATER);
+
+        // draw far field, behind every chunk so it goes after them and the depth test throws most of it away
+        profiler.begin(PROFILE_FAR_FIELD);
+        farField.update(terrainMap.currentChunk);
+        farFieldShader.use();
+        farFieldShader.setVec3("lightColor", lightColor);
+        farFieldShader.setVec3("lightPosition", lightPosition);
+        farFieldShader.setMat4("projection", farFieldProjection);
+        farFieldShader.setMat4("view", view);
+        glDepthRange(FAR_FIELD_DEPTH_SPLIT, 1.0);
+        farField.draw(farFieldShader);
+        glDepthRange(0.0, FAR_FIELD_DEPTH_SPLIT);
+        profiler.end(PROFILE_FAR_FIELD);
 
         // draw light box
+        profiler.begin(PROFILE_CUBES);
         lightCubeShader.use();
         lightCubeShader.setMat4("projection", projection);
         lightCubeShader.setMat4("view", view);
@@ -574,9 +740,12 @@ int main(void)
         lightCubeShader.setMat4("model", model);
         glBindVertexArray(lightVAO);
         glDrawArrays(GL_TRIANGLES, 0, 36);
+        profiler.end(PROFILE_CUBES);
 
         // draw skybox as last
+        profiler.begin(PROFILE_SKYBOX);
         glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
+        glDepthRange(0.0, 1.0);  // the whole range so the sky lands at 1, behind the far field
         skyBoxShader.use();
         view = glm::mat4(glm::mat3(camera.GetViewMatrix())); // remove translation from the view matrix
         skyBoxShader.setMat4("view", view);
@@ -588,27 +757,61 @@ int main(void)
         glDrawArrays(GL_TRIANGLES, 0, 36);
         glBindVertexArray(0);
         glDepthFunc(GL_LESS); // set depth function back to default
+        profiler.end(PROFILE_SKYBOX);
 
         // this part actually renders the gui
-        ImGui::Render();
-        ImGui::EndFrame();
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-
-        lastChunk = terrainMap.currentChunk;
+        {
+            ProfileScope imguiScope(profiler, PROFILE_IMGUI);
+            ImGui::Render();
+            ImGui::EndFrame();
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
+        profiler.end(PROFILE_FRAME);
+        glCallCounters().endFrame();
+
+        if (benchmark.enabled) {
+            // drivers queue the frame's work, llvmpipe included, it isn't done until glFinish returns
+            glFinish();
+            benchmarkReport.addFrame(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count(), glCallCounters().lastFrame());
+            for (int section = 0; section < profiler.sectionCount(); section++) {
+                benchmarkReport.addPassCalls(profiler.sectionName(section), profiler.frameCalls(section));
+            }
+            benchmarkGenerationMilliseconds += generationMilliseconds;
+            benchmarkFrame++;
+        }
 
         // Swap front and back buffers & check and call events
-        glfwSwapBuffers(window);
+        {
+            TRACE_SCOPE("glfwSwapBuffers");
+            glfwSwapBuffers(window);
+        }
         glfwPollEvents();
     }
 
+    int exitCode = 0;
+    if (benchmark.enabled) {
+        if (benchmarkReport.write(benchmark.outputFile, benchmark, terrainMap.chunksGenerated, terrainRenderer->totalUploadedBytes(), benchmarkGenerationMilliseconds)) {
+            std::cout << "Benchmark report written to " << benchmark.outputFile << std::endl;
+        }
+        else {
+            exitCode = -1;
+        }
+    }
+    if (Tracer::enabled() && Tracer::instance().writeChromeJson(traceFile)) {
+        std::cout << "Trace written to " << traceFile << std::endl;
+    }
+
     glDeleteVertexArrays(2, VAOs);
     glDeleteBuffers(2, VBOs);
     glDeleteVertexArrays(1, &lightVAO);
+    memoryStats().deleted(GPU_VERTEX_ARRAY, 2, VAOs);
+    memoryStats().deleted(GPU_BUFFER, 2, VBOs);
+    memoryStats().deleted(GPU_VERTEX_ARRAY, 1, &lightVAO);
     ImGui::DestroyContext();
     ImGui_ImplOpenGL3_Shutdown();
 
     glfwTerminate();
-    return 0;
+    return exitCode;
 }
 
 
@@ -681,6 +884,22 @@ void processInput(GLFWwindow* window) {
         }
     }
 
+    if (glfwGetKey(window, GLFW_KEY_F9) == GLFW_PRESS && f9Pressed != true) {
+        f9Pressed = true;
+
+        if (!Tracer::enabled()) {
+            Tracer::instance().clear();
+            Tracer::instance().setEnabled(true);
+            std::cout << "Tracing, F9 again writes " << traceFile << std::endl;
+        }
+        else {
+            Tracer::instance().setEnabled(false);
+            if (Tracer::instance().writeChromeJson(traceFile)) {
+                std::cout << "Trace written to " << traceFile << std::endl;
+            }
+        }
+    }
+
     if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_RELEASE) {
         qPressed = false;
     }
@@ -688,6 +907,10 @@ void processInput(GLFWwindow* window) {
     if (glfwGetKey(window, GLFW_KEY_T) == GLFW_RELEASE) {
         tPressed = false;
     }
+
+    if (glfwGetKey(window, GLFW_KEY_F9) == GLFW_RELEASE) {
+        f9Pressed = false;
+    }
 }
 void updateLastFrame(void) {
     float currentFrame = glfwGetTime();
@@ -697,63 +920,46 @@ void updateLastFrame(void) {
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
     glViewport(0, 0, width, height);
 }
-void terrainBufferWriter(std::vector<GLuint> *terrainVAOs, std::vector<GLuint> *terrainVBOs, std::vector<GLuint> *terrainEBOs, terrainChunk *chunk) {
-    // terrain mesh stuff ------------------------------------------------------------------
-    GLuint VAO, VBO, EBO;
-
-    // Generate and bind the VAO
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    // Generate and bind the VBO
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, chunk->vertices.size() * sizeof(float), &chunk->vertices[0], GL_STATIC_DRAW);
-
-    // Generate and bind the EBO
-    glGenBuffers(1, &EBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, chunk->indices.size() * sizeof(unsigned int), &chunk->indices[0], GL_STATIC_DRAW);
-
-    // Set up the vertex attributes
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    // normal attribute
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    // texture attribute
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-
-    // Store the VAO, VBO, and EBO for later use
-    terrainVAOs->push_back(VAO);
-    terrainVBOs->push_back(VBO);
-    terrainEBOs->push_back(EBO);
+// stbi_load keeping the image's own channel count, the decoded image counts as CPU_TEXTURES until freeImage
+unsigned char* loadImage(const char* path, int* width, int* height, int* channels) {
+    TRACE_SCOPE("decode image");
+    unsigned char* data = stbi_load(path, width, height, channels, 0);
+    if (data) {
+        memoryStats().addCpuBytes(CPU_TEXTURES, (size_t)*width * *height * *channels);
+    }
+    return data;
+}
+void freeImage(unsigned char* data, int width, int height, int channels) {
+    if (data) {
+        memoryStats().subtractCpuBytes(CPU_TEXTURES, (size_t)width * height * channels);
+    }
+    stbi_image_free(data);
 }
 unsigned int loadCubemap(std::vector<std::string> faces)
 {
+    TRACE_SCOPE("load cubemap");
     unsigned int textureID;
     glGenTextures(1, &textureID);
+    memoryStats().created(GPU_TEXTURE, 1);
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
     int width, height, nrChannels;
+    size_t textureBytes = 0;
     for (unsigned int i = 0; i < faces.size(); i++)
     {
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
+        unsigned char* data = loadImage(faces[i].c_str(), &width, &height, &nrChannels);
         if (data)
         {
             glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
                 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
             );
-            stbi_image_free(data);
+            textureBytes += MemoryStats::textureBytes(width, height, 1, 3, false);
+            freeImage(data, width, height, nrChannels);
         }
         else
         {
             std::cout << "Cubemap tex failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
+            freeImage(data, width, height, nrChannels);
         }
     }
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -761,6 +967,7 @@ unsigned int loadCubemap(std::vector<std::string> faces)
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    memoryStats().allocated(GPU_TEXTURE, textureID, "skybox", textureBytes);
 
     return textureID;
 }
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <utility>
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+#include <glm/glm/glm.hpp>
+
+#include "camera.h"
+#include "glcounters.h"
+
+// Command line for a benchmark run:
+//   --benchmark <camera path file> [--frames N] [--timestep seconds] [--output report.json]
+// and with or without a benchmark:
+//   --disk-cache <directory> keeps generated heightfields in region files there between runs, off by default so a
+//     benchmark run doesn't depend on what the last one left behind
+//   --trace <file> records a timeline from startup, the newest events of each thread are written at exit, see trace.h
+struct benchmarkSettings {
+    bool enabled = false;
+    std::string pathFile;
+    std::string outputFile = "benchmark.json";
+    int frames = 1000;
+    float timestep = 1.0f / 60.0f;
+    std::string diskCacheDirectory; // empty for no disk cache
+    std::string traceFile;
+
+    // false if the arguments asked for a benchmark but couldn't be read, the problem has been printed
+    static bool fromArguments(int argc, char** argv, benchmarkSettings* settings) {
+        for (int i = 1; i < argc; i++) {
+            bool hasValue = i + 1 < argc;
+            if (std::strcmp(argv[i], "--benchmark") == 0 && hasValue) {
+                settings->enabled = true;
+                settings->pathFile = argv[++i];
+            }
+            else if (std::strcmp(argv[i], "--frames") == 0 && hasValue) {
+                settings->frames = std::atoi(argv[++i]);
+            }
+            else if (std::strcmp(argv[i], "--timestep") == 0 && hasValue) {
+                settings->timestep = (float)std::atof(argv[++i]);
+            }
+            else if (std::strcmp(argv[i], "--output") == 0 && hasValue) {
+                settings->outputFile = argv[++i];
+            }
+            else if (std::strcmp(argv[i], "--disk-cache") == 0 && hasValue) {
+                settings->diskCacheDirectory = argv[++i];
+            }
+            else if (std::strcmp(argv[i], "--trace") == 0 && hasValue) {
+                settings->traceFile = argv[++i];
+            }
+            else {
+                std::cout << "ERROR UNKNOWN ARGUMENT " << argv[i] << std::endl;
+                std::cout << "usage: --benchmark <camera path> [--frames N] [--timestep seconds] [--output report.json] [--disk-cache directory] [--trace trace.json]" << std::endl;
+                return false;
+            }
+        }
+        if (settings->enabled && (settings->frames <= 0 || settings->timestep <= 0.0f)) {
+            std::cout << "ERROR BENCHMARK NEEDS A POSITIVE FRAME COUNT AND TIMESTEP" << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+// Scripted camera for benchmark runs. The file has one keyframe per line, "time x y z yaw pitch" with time in seconds
+// and angles in degrees, blank lines and lines starting with # are skipped. Keyframes must be in time order, the camera
+// moves linearly between them and holds the first and last keyframe outside their range.
+class CameraPath {
+public:
+    bool load(const std::string& path) {
+        std::ifstream file(path);
+        if (!file) {
+            std::cout << "ERROR CAMERA PATH COULD NOT BE OPENED " << path << std::endl;
+            return false;
+        }
+        keyframes.clear();
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(file, line)) {
+            lineNumber++;
+            size_t first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#') {
+                continue;
+            }
+            std::istringstream values(line);
+            keyframe key;
+            if (!(values >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch)) {
+                std::cout << "ERROR CAMERA PATH LINE " << lineNumber << " IS NOT time x y z yaw pitch" << std::endl;
+                return false;
+            }
+            if (!keyframes.empty() && key.time < keyframes.back().time) {
+                std::cout << "ERROR CAMERA PATH LINE " << lineNumber << " GOES BACK IN TIME" << std::endl;
+                return false;
+            }
+            keyframes.push_back(key);
+        }
+        if (keyframes.empty()) {
+            std::cout << "ERROR CAMERA PATH HAS NO KEYFRAMES " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Moves and points the camera where the path is at time seconds
+    void apply(Camera& camera, float time) const {
+        size_t next = 0;
+        while (next < keyframes.size() && keyframes[next].time <= time) {
+            next++;
+        }
+        const keyframe& a = keyframes[next == 0 ? 0 : next - 1];
+        const keyframe& b = keyframes[next == keyframes.size() ? next - 1 : next];
+        float span = b.time - a.time;
+        float t = span > 0.0f ? glm::clamp((time - a.time) / span, 0.0f, 1.0f) : 0.0f;
+
+        camera.Position = glm::mix(a.position, b.position, t);
+        camera.SetOrientation(a.yaw + (b.yaw - a.yaw) * t, a.pitch + (b.pitch - a.pitch) * t);
+    }
+
+    float duration() const {
+        return keyframes.empty() ? 0.0f : keyframes.back().time;
+    }
+
+private:
+    struct keyframe {
+        float time = 0.0f;
+        glm::vec3 position = glm::vec3(0.0f);
+        float yaw = 0.0f;
+        float pitch = 0.0f;
+    };
+
+    std::vector<keyframe> keyframes;
+};
+
+// Per-frame numbers of a benchmark run, written out as JSON when it ends
+class BenchmarkReport {
+public:
+    // glCalls is the frame's GL call counts, draw calls included
+    void addFrame(double frameMilliseconds, const glCallCounts& glCalls) {
+        frameTimes.push_back(frameMilliseconds);
+        frameGlCalls.push_back(glCalls);
+    }
+
+    // A pass's GL calls for the frame, summed over the run per pass name
+    void addPassCalls(const std::string& pass, const glCallCounts& glCalls) {
+        for (std::pair<std::string, glCallCounts>& total : passCalls) {
+            if (total.first == pass) {
+                total.second += glCalls;
+                return;
+            }
+        }
+        passCalls.push_back(std::make_pair(pass, glCalls));
+    }
+
+    // totals are the run's counters, generationMilliseconds is the generation threads' time summed over the threads
+    bool write(const std::string& path, const benchmarkSettings& settings, int chunksGenerated, size_t bytesUploaded,
+        double generationMilliseconds) const {
+        FILE* file = std::fopen(path.c_str(), "w");
+        if (file == nullptr) {
+            std::cout << "ERROR BENCHMARK REPORT COULD NOT BE WRITTEN " << path << std::endl;
+            return false;
+        }
+
+        std::vector<double> sorted = frameTimes;
+        std::sort(sorted.begin(), sorted.end());
+        double totalTime = 0.0;
+        for (double time : frameTimes) {
+            totalTime += time;
+        }
+        double frames = std::max<size_t>(frameTimes.size(), 1);
+
+        std::fprintf(file, "{\n");
+        std::fprintf(file, "  \"camera_path\": \"%s\",\n", escaped(settings.pathFile).c_str());
+        std::fprintf(file, "  \"frames\": %zu,\n", frameTimes.size());
+        std::fprintf(file, "  \"timestep\": %.6f,\n", settings.timestep);
+        std::fprintf(file, "  \"frame_ms\": { \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f },\n",
+            totalTime / frames, percentile(sorted, 0.5), percentile(sorted, 0.95), percentile(sorted, 0.99), sorted.empty() ? 0.0 : sorted.back());
+        std::fprintf(file, "  \"chunks_generated\": %i,\n", chunksGenerated);
+        std::fprintf(file, "  \"generation_ms\": %.4f,\n", generationMilliseconds);
+        std::fprintf(file, "  \"bytes_uploaded\": %zu,\n", bytesUploaded);
+        // per frame totals, means and maxima of every counter, then every pass's mean per frame
+        std::fprintf(file, "  \"gl_calls\": {\n");
+        std::fprintf(file, "    \"counted\": %s,\n", GlCallCounters::compiledIn() ? "true" : "false");
+        std::fprintf(file, "    \"per_frame\": {\n");
+        for (int counter = 0; counter < CALL_COUNTER_COUNT; counter++) {
+            unsigned long long total = 0;
+            unsigned long long most = 0;
+            for (const glCallCounts& calls : frameGlCalls) {
+                total += calls.value[counter];
+                most = std::max<unsigned long long>(most, calls.value[counter]);
+            }
+            std::fprintf(file, "      \"%s\": { \"total\": %llu, \"mean\": %.2f, \"max\": %llu }%s\n", GlCallCounters::counterKey((Gl_Call_Counter)counter),
+                total, total / frames, most, counter + 1 < CALL_COUNTER_COUNT ? "," : "");
+        }
+        std::fprintf(file, "    },\n");
+        std::fprintf(file, "    \"per_pass_mean\": {\n");
+        for (size_t pass = 0; pass < passCalls.size(); pass++) {
+            std::fprintf(file, "      \"%s\": {", escaped(passCalls[pass].first).c_str());
+            for (int counter = 0; counter < CALL_COUNTER_COUNT; counter++) {
+                std::fprintf(file, " \"%s\": %.2f%s", GlCallCounters::counterKey((Gl_Call_Counter)counter),
+                    passCalls[pass].second.value[counter] / frames, counter + 1 < CALL_COUNTER_COUNT ? "," : " ");
+            }
+            std::fprintf(file, "}%s\n", pass + 1 < passCalls.size() ? "," : "");
+        }
+        std::fprintf(file, "    }\n");
+        std::fprintf(file, "  }\n");
+        std::fprintf(file, "}\n");
+        std::fclose(file);
+        return true;
+    }
+
+private:
+    std::vector<double> frameTimes;
+    std::vector<glCallCounts> frameGlCalls;
+    std::vector<std::pair<std::string, glCallCounts>> passCalls; // in the order the passes first reported
+
+    static double percentile(const std::vector<double>& sorted, double fraction) {
+        if (sorted.empty()) {
+            return 0.0;
+        }
+        size_t index = std::min(sorted.size() - 1, (size_t)(fraction * sorted.size()));
+        return sorted[index];
+    }
+
+    static std::string escaped(const std::string& text) {
+        std::string result;
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                result += '\\';
+            }
+            result += c;
+        }
+        return result;
+    }
+};
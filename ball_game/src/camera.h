@@ -6,6 +6,8 @@
 #include <glm/glm/glm.hpp>
 #include <glm/glm/gtc/matrix_transform.hpp>
 
+#include "frustum.h"
+
 const float YAW = -90.0f;
 const float PITCH = 0.0f;
 const float SPEED = 35.5f;
@@ -54,6 +56,11 @@ public:
 		return glm::lookAt(Position, Position + Front, Up);
 	}
 
+	// world space frustum for culling, projection has to be the one the frame is drawn with
+	viewFrustum GetFrustum(const glm::mat4& projection) {
+		return viewFrustum::fromMatrix(projection * GetViewMatrix());
+	}
+
 	void ProcessKeyboard(Camera_Movement direction, float deltaTime)
 	{
 		float velocity = MovementSpeed * deltaTime;
@@ -97,6 +104,14 @@ public:
 		updateCameraVectors();
 	}
 
+	// Points the camera directly, for scripted paths
+	void SetOrientation(float yaw, float pitch)
+	{
+		Yaw = yaw;
+		Pitch = pitch;
+		updateCameraVectors();
+	}
+
 private:
 	void updateCameraVectors() {
 		glm::vec3 front;
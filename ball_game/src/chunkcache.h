@@ -0,0 +1,279 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+
+#include "mappedfile.h"
+
+// What a cached chunk needs besides its heightfield and slopes
+struct cachedChunkInfo {
+    float minHeight = 0.0f;
+    float maxHeight = 0.0f;
+    bool hasWater = false;
+};
+
+// Generated heightfields on disk, grouped into region files of REGION_SIZE^2 chunks that are memory mapped on first use.
+// planes is 3 when the dh/dx and dh/dz planes the SHARED_VERTEX normals come from are kept after the heights, 1 otherwise.
+// Every chunk has a fixed size record at a known offset, a hit copies the header and planes out of the page cache and
+// checksums the copy with nothing parsed.
+// Region files carry a hash of the generation parameters, one written with different parameters or record layout is
+// discarded and refilled as its chunks are generated again. At most MAX_OPEN_REGIONS stay mapped, the least recently
+// used one is closed when another is needed; a load or store still copying out of a closed region keeps its mapping
+// alive until it finishes. Records carry a checksum of their planes, a record torn by a crash reads back as a miss.
+// load and store can be called from every generation thread at once as long as no two calls are for the same chunk.
+class ChunkRegionCache {
+public:
+    static const int REGION_SIZE = 32;
+    static const int MAX_OPEN_REGIONS = 9; // the 3x3 regions around the camera
+
+    ChunkRegionCache(const std::string& directory, uint64_t parameterHash, int heightfieldSize, int planes) :
+        directory(directory),
+        parameterHash(parameterHash),
+        heightfieldSize(heightfieldSize),
+        planes(planes),
+        planeSize((size_t)heightfieldSize * heightfieldSize * sizeof(float)),
+        recordSize(sizeof(recordHeader) + planes * planeSize) {
+        usable = MappedFile::createDirectory(directory);
+        if (!usable) {
+            std::cout << "ERROR CHUNK CACHE DIRECTORY COULD NOT BE CREATED " << directory << std::endl;
+        }
+    }
+
+    ChunkRegionCache(const ChunkRegionCache&) = delete;
+    ChunkRegionCache& operator=(const ChunkRegionCache&) = delete;
+
+    // Copies chunk (chunkX, chunkZ)'s heightfield (and slopes with 3 planes) out of its region, false if it was never stored
+    bool load(int chunkX, int chunkZ, float* heightfield, float* slopes, cachedChunkInfo* info) {
+        unsigned char* record = nullptr;
+        std::shared_ptr<MappedFile> region = findRecord(chunkX, chunkZ, &record);
+        recordHeader header;
+        if (record != nullptr) {
+            std::memcpy(&header, record, sizeof(header));
+        }
+        if (record == nullptr || header.stored != RECORD_STORED) {
+            missCount++;
+            return false;
+        }
+
+        std::memcpy(heightfield, record + sizeof(recordHeader), planeSize);
+        if (planes > 1) {
+            std::memcpy(slopes, record + sizeof(recordHeader) + planeSize, (planes - 1) * planeSize);
+        }
+        if (header.checksum != planesChecksum(heightfield, planes > 1 ? slopes : nullptr)) {
+            missCount++;
+            return false;
+        }
+        info->minHeight = header.minHeight;
+        info->maxHeight = header.maxHeight;
+        info->hasWater = header.hasWater != 0;
+        hitCount++;
+        return true;
+    }
+
+    // Writes the planes then the header with their checksum. The OS may write the pages back in any order, a crash
+    // in between leaves a header whose checksum doesn't match and the record is generated again.
+    void store(int chunkX, int chunkZ, const float* heightfield, const float* slopes, const cachedChunkInfo& info) {
+        unsigned char* record = nullptr;
+        std::shared_ptr<MappedFile> region = findRecord(chunkX, chunkZ, &record);
+        if (record == nullptr) {
+            return;
+        }
+        std::memcpy(record + sizeof(recordHeader), heightfield, planeSize);
+        if (planes > 1) {
+            std::memcpy(record + sizeof(recordHeader) + planeSize, slopes, (planes - 1) * planeSize);
+        }
+        recordHeader header;
+        header.stored = RECORD_STORED;
+        header.hasWater = info.hasWater ? 1 : 0;
+        header.minHeight = info.minHeight;
+        header.maxHeight = info.maxHeight;
+        header.checksum = planesChecksum(heightfield, planes > 1 ? slopes : nullptr);
+        std::memcpy(record, &header, sizeof(header));
+    }
+
+    int hits() const {
+        return hitCount;
+    }
+
+    int misses() const {
+        return missCount;
+    }
+
+    int openRegions() {
+        std::lock_guard<std::mutex> lock(regionMutex);
+        int open = 0;
+        for (const auto& region : regions) {
+            open += region.second.file->isOpen() ? 1 : 0;
+        }
+        return open;
+    }
+
+    // Address space of the open regions, the pages the OS has in memory are at most this
+    size_t mappedBytes() {
+        std::lock_guard<std::mutex> lock(regionMutex);
+        size_t bytes = 0;
+        for (const auto& region : regions) {
+            bytes += region.second.file->size();
+        }
+        return bytes;
+    }
+
+    // FNV-1a, chain calls over every value that changes the generated heights to build parameterHash
+    static uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+        const unsigned char* bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+private:
+    static const uint32_t FILE_VERSION = 3;
+    static const uint32_t RECORD_STORED = 0x444C4843; // "CHLD", anything else reads as empty
+
+    struct regionHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t regionSize;
+        uint32_t heightfieldSize;
+        uint32_t planes;
+        uint64_t parameterHash;
+    };
+
+    struct recordHeader {
+        uint32_t stored;
+        uint32_t hasWater;
+        float minHeight;
+        float maxHeight;
+        uint64_t checksum;  // checksumWords over the planes
+    };
+
+    struct openRegion {
+        std::shared_ptr<MappedFile> file;
+        uint64_t lastUse;
+    };
+
+    std::string directory;
+    uint64_t parameterHash;
+    int heightfieldSize;
+    int planes;
+    size_t planeSize;
+    size_t recordSize;
+    bool usable = false;
+    std::map<std::pair<int, int>, openRegion> regions; // regions that failed to open stay closed in here until evicted
+    uint64_t useCounter = 0;
+    std::mutex regionMutex;
+    std::atomic<int> hitCount{ 0 };
+    std::atomic<int> missCount{ 0 };
+
+    static int regionOf(int chunk) {
+        return chunk >= 0 ? chunk / REGION_SIZE : (chunk + 1) / REGION_SIZE - 1;
+    }
+
+    uint64_t planesChecksum(const float* heightfield, const float* slopes) const {
+        uint64_t hash = checksumWords(heightfield, planeSize, 14695981039346656037ull);
+        if (slopes != nullptr) {
+            hash = checksumWords(slopes, (planes - 1) * planeSize, hash);
+        }
+        return hash;
+    }
+
+    // Only has to catch torn records, not spread bits. Four independent lanes over 8 byte words so the multiplies
+    // overlap, each step is a bijection of the lane so any one changed word changes the result. Tail bytes go
+    // through hashBytes.
+    static uint64_t checksumWords(const void* data, size_t size, uint64_t hash) {
+        const unsigned char* bytes = (const unsigned char*)data;
+        uint64_t lanes[4] = { hash, hash + 1, hash + 2, hash + 3 };
+        size_t blocks = size / 32;
+        for (size_t block = 0; block < blocks; block++) {
+            for (int lane = 0; lane < 4; lane++) {
+                uint64_t word;
+                std::memcpy(&word, bytes + block * 32 + lane * 8, 8);
+                lanes[lane] = (lanes[lane] ^ word) * 0x9E3779B97F4A7C15ull;
+                lanes[lane] ^= lanes[lane] >> 29;
+            }
+        }
+        hash = hashBytes(lanes, sizeof(lanes), hash);
+        return hashBytes(bytes + blocks * 32, size - blocks * 32, hash);
+    }
+
+    // Sets record to the chunk's record in its region, mapping the region first if needed, or nullptr if the region
+    // file can't be used. The returned region keeps the mapping alive while the caller copies, only the lookup is locked.
+    std::shared_ptr<MappedFile> findRecord(int chunkX, int chunkZ, unsigned char** record) {
+        *record = nullptr;
+        if (!usable) {
+            return nullptr;
+        }
+        std::pair<int, int> region(regionOf(chunkX), regionOf(chunkZ));
+        std::shared_ptr<MappedFile> file;
+        {
+            std::lock_guard<std::mutex> lock(regionMutex);
+            auto entry = regions.find(region);
+            if (entry == regions.end()) {
+                if ((int)regions.size() >= MAX_OPEN_REGIONS) {
+                    evictLeastRecentlyUsed();
+                }
+                std::shared_ptr<MappedFile> opened(new MappedFile());
+                mapRegion(region, opened.get());
+                entry = regions.emplace(region, openRegion{ opened, 0 }).first;
+            }
+            entry->second.lastUse = ++useCounter;
+            file = entry->second.file;
+        }
+        if (!file->isOpen()) {
+            return nullptr;
+        }
+
+        int localX = chunkX - region.first * REGION_SIZE;
+        int localZ = chunkZ - region.second * REGION_SIZE;
+        *record = file->data() + sizeof(regionHeader) + (size_t)(localX * REGION_SIZE + localZ) * recordSize;
+        return file;
+    }
+
+    // regionMutex must be held. The mapping closes once no load or store is using it.
+    void evictLeastRecentlyUsed() {
+        auto oldest = regions.begin();
+        for (auto entry = regions.begin(); entry != regions.end(); ++entry) {
+            if (entry->second.lastUse < oldest->second.lastUse) {
+                oldest = entry;
+            }
+        }
+        regions.erase(oldest);
+    }
+
+    void mapRegion(std::pair<int, int> region, MappedFile* file) {
+        std::string path = directory + "/r." + std::to_string(region.first) + "." + std::to_string(region.second) + ".chunks";
+        size_t fileSize = sizeof(regionHeader) + (size_t)REGION_SIZE * REGION_SIZE * recordSize;
+
+        regionHeader expected;
+        std::memset(&expected, 0, sizeof(expected));
+        std::memcpy(expected.magic, "TERRAIN", 8);
+        expected.version = FILE_VERSION;
+        expected.regionSize = REGION_SIZE;
+        expected.heightfieldSize = (uint32_t)heightfieldSize;
+        expected.planes = (uint32_t)planes;
+        expected.parameterHash = parameterHash;
+
+        if (!file->open(path, fileSize, false)) {
+            std::cout << "ERROR CHUNK CACHE REGION COULD NOT BE MAPPED " << path << std::endl;
+            return;
+        }
+        if (std::memcmp(file->data(), &expected, sizeof(expected)) == 0) {
+            return;
+        }
+
+        // new file or stale parameters, start over with every record empty
+        if (!file->open(path, fileSize, true)) {
+            std::cout << "ERROR CHUNK CACHE REGION COULD NOT BE MAPPED " << path << std::endl;
+            return;
+        }
+        std::memcpy(file->data(), &expected, sizeof(expected));
+    }
+};
@@ -4,6 +4,14 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoord;
 
+// packed layout, see packedTerrainVertex in terrain.h
+layout (location = 3) in uvec2 aLatticePosition;
+layout (location = 4) in float aPackedHeight;
+layout (location = 5) in vec2 aPackedNormal;
+
+// heightmap grid instance, origin x, origin z, level of detail and heightmap layer
+layout (location = 6) in vec4 aChunk;
+
 out vec3 FragPosition;
 out vec2 TexCoord;
 out vec3 Normal;
@@ -15,13 +23,123 @@ uniform mat4 view;
 uniform mat4 projection;
 uniform float mapHeight;
 
+uniform bool packedVertices;
+uniform samplerBuffer chunkData; // origin x, origin z and level of detail per geometry pool slot
+uniform int slotVertices;        // vertices per slot, gl_VertexID includes the slot's base vertex
+uniform float gridSpacing;
+uniform float textureSize;
+
+uniform bool heightmapGrid;        // no vertex data, lattice point from gl_VertexID and height from the chunk's layer
+uniform sampler2DArray heightMap;  // heightfield per chunk, lattice plus a one sample apron, see Terrain::heightfieldSize
+int chunkLayer = 0;
+
+// level of detail morphing, see Terrain::lodLevelCount
+const int MAX_LOD_LEVELS = 8;
+uniform usamplerBuffer packedVertexData; // the geometry pool's vertex buffer, one texel per packed vertex
+uniform samplerBuffer floatVertexData;   // the geometry pool's vertex buffer, two texels per float vertex
+uniform int verticesPerSide;
+uniform int lodLevels;
+uniform int lodStrides[MAX_LOD_LEVELS];
+uniform vec2 lodMorphRanges[MAX_LOD_LEVELS]; // distance a level starts and finishes morphing to the next one
+uniform bool lodMorph;                      // off when the heights to morph to can't be read, levels switch outright
+uniform vec3 cameraPosition;
+
+vec3 octahedralDecode(vec2 encoded)
+{
+    vec3 normal = vec3(encoded.x, 1.0 - abs(encoded.x) - abs(encoded.y), encoded.y);
+    if (normal.y < 0.0) {
+        vec2 signs = vec2(normal.x >= 0.0 ? 1.0 : -1.0, normal.z >= 0.0 ? 1.0 : -1.0);
+        normal.xz = (1.0 - abs(normal.zx)) * signs;
+    }
+    return normalize(normal);
+}
+
+// height of lattice point (i, j) of the instance's heightmap, -1 and verticesPerSide reach into the apron
+float gridHeight(int i, int j)
+{
+    return texelFetch(heightMap, ivec3(j + 1, i + 1, chunkLayer), 0).r;
+}
+
+// height of lattice point (i, j) in the chunk whose vertices start at slotBase
+float latticeHeight(int slotBase, int i, int j)
+{
+    if (heightmapGrid) {
+        return gridHeight(min(i, verticesPerSide - 1), min(j, verticesPerSide - 1));
+    }
+    int index = slotBase + min(i, verticesPerSide - 1) * verticesPerSide + min(j, verticesPerSide - 1);
+    if (packedVertices) {
+        return mix(-mapHeight, mapHeight, float(texelFetch(packedVertexData, index).z) / 65535.0);
+    }
+    return texelFetch(floatVertexData, index * 2).y;
+}
+
+// height of the next coarser level's surface under lattice point (i, j), same a b c / a c d split as the index lists
+float coarseHeight(int slotBase, int i, int j, int coarseStride)
+{
+    int ci = (i / coarseStride) * coarseStride;
+    int cj = (j / coarseStride) * coarseStride;
+    float du = float(i - ci) / float(coarseStride);
+    float dv = float(j - cj) / float(coarseStride);
+
+    float a = latticeHeight(slotBase, ci, cj);
+    float b = latticeHeight(slotBase, ci, cj + coarseStride);
+    float c = latticeHeight(slotBase, ci + coarseStride, cj + coarseStride);
+    float d = latticeHeight(slotBase, ci + coarseStride, cj);
+    if (dv >= du) {
+        return a + dv * (b - a) + du * (c - b);
+    }
+    return a + du * (d - a) + dv * (c - d);
+}
+
 void main()
 {
-    FragPosition = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal; // inverse is not fast will want to do this by the cpu in future
+    vec3 position = aPos;
+    vec3 normal = aNormal;
+    vec2 texCoord = aTexCoord;
+
+    int slotBase = 0;
+    vec4 chunk;
+    if (heightmapGrid) {
+        chunk = aChunk;
+        chunkLayer = int(aChunk.w);
+        int i = gl_VertexID / verticesPerSide;
+        int j = gl_VertexID - i * verticesPerSide;
+        position = vec3(chunk.x + float(i) * gridSpacing, gridHeight(i, j), chunk.y + float(j) * gridSpacing);
+        // central difference over the apron, SHARED_VERTEX chunks use the analytic gradient of the same surface
+        normal = normalize(vec3(gridHeight(i - 1, j) - gridHeight(i + 1, j), 2.0 * gridSpacing, gridHeight(i, j - 1) - gridHeight(i, j + 1)));
+        texCoord = position.xz / textureSize;
+    }
+    else {
+        int slot = gl_VertexID / slotVertices;
+        slotBase = slot * slotVertices;
+        chunk = texelFetch(chunkData, slot);
+    }
+
+    if (packedVertices && !heightmapGrid) {
+        position.xz = chunk.xy + vec2(aLatticePosition) * gridSpacing;
+        position.y = mix(-mapHeight, mapHeight, aPackedHeight);
+        normal = octahedralDecode(aPackedNormal);
+        texCoord = position.xz / textureSize;
+    }
+
+    // blend towards the next level's surface so the chunk matches it by the time it switches level
+    int level = int(chunk.z);
+    if (lodMorph && level + 1 < lodLevels) {
+        vec2 morphRange = lodMorphRanges[level];
+        float morph = clamp((distance(position.xz, cameraPosition.xz) - morphRange.x) / (morphRange.y - morphRange.x), 0.0, 1.0);
+        if (morph > 0.0) {
+            int vertex = gl_VertexID - slotBase;
+            int i = vertex / verticesPerSide;
+            int j = vertex - i * verticesPerSide;
+            position.y = mix(position.y, coarseHeight(slotBase, i, j, lodStrides[level + 1]), morph);
+        }
+    }
+
+    FragPosition = vec3(model * vec4(position, 1.0));
+    Normal = mat3(transpose(inverse(model))) * normal; // inverse is not fast will want to do this by the cpu in future
 
     gl_Position = projection * view * vec4(FragPosition, 1.0);
-    TexCoord = aTexCoord;
-    Height = aPos.y;
+    TexCoord = texCoord;
+    Height = position.y;
     chunkHeight = mapHeight;
- }
\ No newline at end of file
+ }
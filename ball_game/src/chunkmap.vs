@@ -1,7 +1,15 @@
 #version 410 core
 
-layout (location = 0) in vec3 aPos;
-layout(location = 1) in vec3 aNormal;
-layout (location = 2) in vec2 aTex;
+// TESSELLATED_PATCHES, see TerrainPatchRenderer in terrainrenderer.h
+layout (location = 0) in vec2 aPatchCorner; // x/z inside the chunk
+layout (location = 1) in vec3 aChunk;       // per instance, chunk origin x, origin z and heightmap layer
 
-out
\ No newline at end of file
+out vec2 LocalPosition;
+out float Layer;
+
+void main()
+{
+    LocalPosition = aPatchCorner;
+    Layer = aChunk.z;
+    gl_Position = vec4(aChunk.x + aPatchCorner.x, 0.0, aChunk.y + aPatchCorner.y, 1.0); // heights are added in chunkmap.tes
+}
@@ -0,0 +1,48 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec3 Normal;
+in vec3 FragPosition;
+in float Height;
+
+uniform vec3 lightPosition;
+uniform vec3 lightColor;
+uniform float mapHeight;
+uniform float waterLevel;
+
+void main()
+{
+    // ambient and diffuse only, specular highlights on cells this big just flicker
+    float ambientStrength = 0.1;
+    vec3 ambient = ambientStrength * lightColor;
+
+    vec3 norm = Height < waterLevel ? vec3(0.0, 1.0, 0.0) : normalize(Normal);
+    vec3 lightDirection = normalize(lightPosition - FragPosition);
+    float diff = max(dot(norm, lightDirection), 0.0);
+    vec3 diffuse = diff * lightColor;
+
+    // same bands as chunkmap.frag
+    float normalizedHeight = (Height + mapHeight) / (2.0 * mapHeight);
+
+    vec3 color;
+    if (normalizedHeight < 0.2) {
+        color = vec3(0.0, 0.0, 1.0);
+    } else if (normalizedHeight < 0.25) {
+        color = vec3(1.0, 1.0, 0.0);
+    } else if (normalizedHeight < 0.6) {
+        color = vec3(0.0, 1.0, 0.0);
+    } else if (normalizedHeight < 0.8) {
+        color = vec3(0.6, 0.3, 0.0);
+    } else {
+        color = vec3(1.0, 1.0, 1.0);
+    }
+
+    vec3 up = vec3(0.0, 1.0, 0.0);
+    float steepness = dot(norm, up);
+    if (steepness < 0.50 && color != vec3(1.0,1.0,1.0)) {
+        color = vec3(0.5, 0.5, 0.5);
+    }
+
+    vec3 result = (ambient + diffuse) * color;
+    FragColor = vec4(result, 1.0);
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <cstdlib>
+
+#include <glad/glad.h>
+
+#include "shader.h"
+#include "terrain.h"
+#include "memorystats.h"
+
+// Low resolution terrain from the edge of the chunk window out to radiusChunks chunks, one vertex per chunk corner.
+// Heights live in a toroidal texture indexed by world corner, so moving one chunk only samples and uploads the row or
+// column that came into range. The index buffer never changes since the hole left for the chunk window stays centred
+// on the current chunk, and the vertex positions come from gl_VertexID so there is no vertex buffer at all.
+// The hole's edge has one vertex per chunk corner where the chunks have chunkResolution, a skirt hangs down from it
+// (vertex ids past the grid are the same corners lowered by skirtDepth) so the sky never shows through the seam.
+class FarField {
+public:
+    static const int HEIGHT_TEXTURE_UNIT = 1;
+
+    FarField(const Terrain& terrain, int radiusChunks, int holeRadiusChunks) :
+        terrain(terrain),
+        radius(radiusChunks),
+        gridSize(2 * radiusChunks + 2),
+        cellSize((float)terrain.chunkSize),
+        holeRadius(holeRadiusChunks) {
+        glGenVertexArrays(1, &VAO);
+        memoryStats().created(GPU_VERTEX_ARRAY, 1);
+        glBindVertexArray(VAO);
+
+        // the chunk window covers chunks radius - hole to radius + hole of the grid's cells
+        std::vector<unsigned int> indices;
+        auto vertexAt = [this](int i, int j) { return (unsigned int)(i * gridSize + j); };
+        for (int i = 0; i < gridSize - 1; i++) {
+            for (int j = 0; j < gridSize - 1; j++) {
+                if (std::abs(i - radius) <= holeRadiusChunks && std::abs(j - radius) <= holeRadiusChunks) {
+                    continue;
+                }
+                unsigned int a = vertexAt(i, j), b = vertexAt(i, j + 1), c = vertexAt(i + 1, j + 1), d = vertexAt(i + 1, j);
+                indices.push_back(a);
+                indices.push_back(b);
+                indices.push_back(c);
+                indices.push_back(a);
+                indices.push_back(c);
+                indices.push_back(d);
+            }
+        }
+
+        // around the hole, each edge quad joins two corners to their lowered copies
+        int cornerCount = gridSize * gridSize;
+        int low = radius - holeRadiusChunks;
+        int high = radius + holeRadiusChunks + 1;
+        auto addSkirt = [&](unsigned int a, unsigned int b) {
+            indices.push_back(a);
+            indices.push_back(b);
+            indices.push_back(b + cornerCount);
+            indices.push_back(a);
+            indices.push_back(b + cornerCount);
+            indices.push_back(a + cornerCount);
+        };
+        for (int k = low; k < high; k++) {
+            addSkirt(vertexAt(low, k), vertexAt(low, k + 1));
+            addSkirt(vertexAt(high, k), vertexAt(high, k + 1));
+            addSkirt(vertexAt(k, low), vertexAt(k + 1, low));
+            addSkirt(vertexAt(k, high), vertexAt(k + 1, high));
+        }
+        indexCount = (GLsizei)indices.size();
+
+        glGenBuffers(1, &EBO);
+        memoryStats().created(GPU_BUFFER, 1);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+        memoryStats().allocated(GPU_BUFFER, EBO, "far field indices", indices.size() * sizeof(unsigned int));
+        glBindVertexArray(0);
+
+        glGenTextures(1, &heightTexture);
+        memoryStats().created(GPU_TEXTURE, 1);
+        glBindTexture(GL_TEXTURE_2D, heightTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, gridSize, gridSize, 0, GL_RED, GL_FLOAT, nullptr);
+        memoryStats().allocated(GPU_TEXTURE, heightTexture, "far field heights", MemoryStats::textureBytes(gridSize, gridSize, 1, sizeof(float), false));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        samples.resize(gridSize * gridSize);
+        texels.resize(gridSize * gridSize);
+        memoryStats().addCpuBytes(CPU_TEXTURES, cpuBytes());
+    }
+
+    ~FarField() {
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteTextures(1, &heightTexture);
+        memoryStats().deleted(GPU_VERTEX_ARRAY, 1, &VAO);
+        memoryStats().deleted(GPU_BUFFER, 1, &EBO);
+        memoryStats().deleted(GPU_TEXTURE, 1, &heightTexture);
+        memoryStats().subtractCpuBytes(CPU_TEXTURES, cpuBytes());
+    }
+
+    FarField(const FarField&) = delete;
+    FarField& operator=(const FarField&) = delete;
+
+    // Recentres the grid on the chunk the camera is in, sampling only corners that weren't in the grid before
+    void update(std::pair<int, int> centerChunk) {
+        std::pair<int, int> newOrigin = { centerChunk.first - radius, centerChunk.second - radius };
+        int dx = newOrigin.first - origin.first;
+        int dz = newOrigin.second - origin.second;
+        samplesLastUpdate = 0;
+        if (initialized && dx == 0 && dz == 0) {
+            return;
+        }
+
+        glBindTexture(GL_TEXTURE_2D, heightTexture);
+        if (!initialized || std::abs(dx) >= gridSize || std::abs(dz) >= gridSize) {
+            origin = newOrigin;
+            sampleAll();
+            initialized = true;
+        }
+        else {
+            std::pair<int, int> oldOrigin = origin;
+            origin = newOrigin;
+            // columns that came into range along x, then rows along z over the new x range
+            for (int x = origin.first; x < origin.first + gridSize; x++) {
+                if (x < oldOrigin.first || x >= oldOrigin.first + gridSize) {
+                    sampleColumn(x);
+                }
+            }
+            for (int z = origin.second; z < origin.second + gridSize; z++) {
+                if (z < oldOrigin.second || z >= oldOrigin.second + gridSize) {
+                    sampleRow(z);
+                }
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // Single draw, view, projection and lighting uniforms are set by the caller
+    void draw(Shader& shader) const {
+        shader.setInt("heights", HEIGHT_TEXTURE_UNIT);
+        shader.setVec2("gridOrigin", (float)origin.first, (float)origin.second);
+        shader.setInt("gridSize", gridSize);
+        shader.setFloat("cellSize", cellSize);
+        shader.setFloat("waterLevel", terrain.getWaterLevel());
+        shader.setFloat("mapHeight", terrain.chunkHeight);
+        shader.setFloat("skirtDepth", terrain.chunkHeight); // deeper than any chunk edge can dip below its corners
+
+        glActiveTexture(GL_TEXTURE0 + HEIGHT_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, heightTexture);
+        glBindVertexArray(VAO);
+        glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // distance from the camera's chunk to the outer edge of the grid
+    float reach() const {
+        return radius * cellSize;
+    }
+
+    // distance from the camera's chunk to the edge of the hole, nothing of the far field is closer
+    float holeReach() const {
+        return holeRadius * cellSize;
+    }
+
+    int triangleCount() const {
+        return indexCount / 3;
+    }
+
+    int samplesLastFrame() const {
+        return samplesLastUpdate;
+    }
+
+private:
+    const Terrain& terrain;
+    int radius;
+    int gridSize; // corners per side
+    float cellSize;
+    int holeRadius;
+    std::pair<int, int> origin = { 0,0 }; // world corner of grid vertex (0, 0), in chunks
+    bool initialized = false;
+    int samplesLastUpdate = 0;
+    GLuint VAO = 0;
+    GLuint EBO = 0;
+    GLuint heightTexture = 0;
+    GLsizei indexCount = 0;
+    std::vector<float> samples;
+    std::vector<float> texels;
+
+    // the staging copies of the height texture
+    size_t cpuBytes() const {
+        return (samples.capacity() + texels.capacity()) * sizeof(float);
+    }
+
+    int wrap(int value) const {
+        int wrapped = value % gridSize;
+        return wrapped < 0 ? wrapped + gridSize : wrapped;
+    }
+
+    void sampleAll() {
+        terrain.sampleHeightGrid(origin.first * cellSize, origin.second * cellSize, cellSize, gridSize, gridSize, samples.data());
+        for (int i = 0; i < gridSize; i++) {
+            for (int j = 0; j < gridSize; j++) {
+                texels[wrap(origin.second + j) * gridSize + wrap(origin.first + i)] = samples[i * gridSize + j];
+            }
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, gridSize, gridSize, GL_RED, GL_FLOAT, texels.data());
+        samplesLastUpdate += gridSize * gridSize;
+    }
+
+    // every corner with world x index x in the current z range, one texel column
+    void sampleColumn(int x) {
+        terrain.sampleHeightGrid(x * cellSize, origin.second * cellSize, cellSize, 1, gridSize, samples.data());
+        for (int j = 0; j < gridSize; j++) {
+            texels[wrap(origin.second + j)] = samples[j];
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, wrap(x), 0, 1, gridSize, GL_RED, GL_FLOAT, texels.data());
+        samplesLastUpdate += gridSize;
+    }
+
+    // every corner with world z index z in the current x range, one texel row
+    void sampleRow(int z) {
+        terrain.sampleHeightGrid(origin.first * cellSize, z * cellSize, cellSize, gridSize, 1, samples.data());
+        for (int i = 0; i < gridSize; i++) {
+            texels[wrap(origin.first + i)] = samples[i];
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, wrap(z), gridSize, 1, GL_RED, GL_FLOAT, texels.data());
+        samplesLastUpdate += gridSize;
+    }
+};
@@ -0,0 +1,45 @@
+#version 330 core
+
+out vec3 FragPosition;
+out vec3 Normal;
+out float Height;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+// see FarField in farfield.h, one vertex per chunk corner and no vertex attributes
+uniform sampler2D heights; // toroidal, texel (x mod gridSize, z mod gridSize) holds world corner (x, z)
+uniform vec2 gridOrigin;   // world corner of vertex 0, in chunks
+uniform int gridSize;      // corners per side
+uniform float cellSize;
+uniform float waterLevel;
+uniform float skirtDepth;  // vertex ids from gridSize^2 up are the hole's skirt, corners lowered by this
+
+float cornerHeight(ivec2 local)
+{
+    local = clamp(local, ivec2(0), ivec2(gridSize - 1)); // the texel past the edge wraps to the opposite side of the grid
+    ivec2 corner = ivec2(gridOrigin) + local;
+    ivec2 texel = ((corner % gridSize) + gridSize) % gridSize;
+    return texelFetch(heights, texel, 0).r;
+}
+
+void main()
+{
+    int cornerCount = gridSize * gridSize;
+    int corner = gl_VertexID % cornerCount;
+    ivec2 local = ivec2(corner / gridSize, corner % gridSize);
+    float height = cornerHeight(local);
+
+    // central differences, same as the chunk meshes
+    float left = cornerHeight(local - ivec2(1, 0));
+    float right = cornerHeight(local + ivec2(1, 0));
+    float down = cornerHeight(local - ivec2(0, 1));
+    float up = cornerHeight(local + ivec2(0, 1));
+    Normal = normalize(vec3(left - right, 2.0 * cellSize, down - up));
+
+    // the chunks draw a water plane, out here the ground is flattened to it instead
+    vec2 xz = (gridOrigin + vec2(local)) * cellSize;
+    FragPosition = vec3(xz.x, max(height, waterLevel) - (gl_VertexID >= cornerCount ? skirtDepth : 0.0), xz.y);
+    Height = height;
+    gl_Position = projection * view * vec4(FragPosition, 1.0);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cmath>
+
+#include <glm/glm/glm.hpp>
+
+// The six clip planes of a projection * view matrix in world space, normals point into the frustum
+struct viewFrustum {
+    glm::vec4 planes[6]; // left, right, bottom, top, near, far
+
+    // Gribb/Hartmann plane extraction, each plane is the last row of the matrix plus or minus one of the others
+    static viewFrustum fromMatrix(const glm::mat4& viewProjection) {
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++) {
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        }
+
+        viewFrustum frustum;
+        frustum.planes[0] = rows[3] + rows[0];
+        frustum.planes[1] = rows[3] - rows[0];
+        frustum.planes[2] = rows[3] + rows[1];
+        frustum.planes[3] = rows[3] - rows[1];
+        frustum.planes[4] = rows[3] + rows[2];
+        frustum.planes[5] = rows[3] - rows[2];
+        for (glm::vec4& plane : frustum.planes) {
+            plane /= glm::length(glm::vec3(plane));
+        }
+        return frustum;
+    }
+
+    // Frustum every box intersects, for code that needs one without a camera
+    static viewFrustum everything() {
+        viewFrustum frustum;
+        for (glm::vec4& plane : frustum.planes) {
+            plane = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        }
+        return frustum;
+    }
+
+    // Conservative box test, only false when the box is entirely behind one plane.
+    // Boxes near a frustum corner can pass without being visible, nothing visible is ever rejected.
+    bool intersectsBox(const glm::vec3& minCorner, const glm::vec3& maxCorner) const {
+        for (const glm::vec4& plane : planes) {
+            // corner furthest along the plane normal
+            glm::vec3 corner(plane.x >= 0.0f ? maxCorner.x : minCorner.x,
+                plane.y >= 0.0f ? maxCorner.y : minCorner.y,
+                plane.z >= 0.0f ? maxCorner.z : minCorner.z);
+            if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,367 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glad/glad.h>
+
+enum Gl_Call_Counter {
+    CALL_DRAWS,             // every glDraw* and glMultiDraw* call, a multi-draw counts once
+    CALL_PROGRAM_SWITCHES,  // glUseProgram
+    CALL_VAO_BINDS,
+    CALL_TEXTURE_BINDS,     // glBindTexture and glBindImageTexture
+    CALL_UNIFORM_UPLOADS,   // glUniform*
+    CALL_UPLOAD_BYTES,      // bytes handed to the glBuffer*Data, glBufferStorage and glTex*Image 2D/3D calls, none without data
+    CALL_COUNTER_COUNT
+};
+
+struct glCallCounts {
+    uint64_t value[CALL_COUNTER_COUNT] = {};
+
+    uint64_t operator[](Gl_Call_Counter counter) const {
+        return value[counter];
+    }
+
+    glCallCounts& operator+=(const glCallCounts& other) {
+        for (int i = 0; i < CALL_COUNTER_COUNT; i++) {
+            value[i] += other.value[i];
+        }
+        return *this;
+    }
+
+    glCallCounts operator-(const glCallCounts& other) const {
+        glCallCounts difference;
+        for (int i = 0; i < CALL_COUNTER_COUNT; i++) {
+            difference.value[i] = value[i] - other.value[i];
+        }
+        return difference;
+    }
+};
+
+// Counts the GL calls the engine makes that cost the driver the most. install() swaps glad's function pointers for
+// counting wrappers that forward to the real functions, so every call site is counted without being touched; calls made
+// through another loader (the ImGui backend has its own) aren't seen. Render thread only. Defining
+// GL_CALL_COUNTERS_DISABLED compiles the wrappers out, install() does nothing and every count stays 0.
+class GlCallCounters {
+public:
+    GlCallCounters() = default;
+    GlCallCounters(const GlCallCounters&) = delete;
+    GlCallCounters& operator=(const GlCallCounters&) = delete;
+
+    static bool compiledIn() {
+#ifdef GL_CALL_COUNTERS_DISABLED
+        return false;
+#else
+        return true;
+#endif
+    }
+
+    // Call once after gladLoadGLLoader, functions the context doesn't have are left alone
+    void install() {
+#ifndef GL_CALL_COUNTERS_DISABLED
+        if (installed) {
+            return;
+        }
+        installed = true;
+        realGl& gl = real();
+        wrap(glad_glDrawArrays, gl.drawArrays, countedDrawArrays);
+        wrap(glad_glDrawArraysInstanced, gl.drawArraysInstanced, countedDrawArraysInstanced);
+        wrap(glad_glDrawElements, gl.drawElements, countedDrawElements);
+        wrap(glad_glDrawElementsBaseVertex, gl.drawElementsBaseVertex, countedDrawElementsBaseVertex);
+        wrap(glad_glDrawElementsInstanced, gl.drawElementsInstanced, countedDrawElementsInstanced);
+        wrap(glad_glMultiDrawElementsBaseVertex, gl.multiDrawElementsBaseVertex, countedMultiDrawElementsBaseVertex);
+        wrap(glad_glUseProgram, gl.useProgram, countedUseProgram);
+        wrap(glad_glBindVertexArray, gl.bindVertexArray, countedBindVertexArray);
+        wrap(glad_glBindTexture, gl.bindTexture, countedBindTexture);
+        wrap(glad_glBindImageTexture, gl.bindImageTexture, countedBindImageTexture);
+        wrap(glad_glUniform1i, gl.uniform1i, countedUniform1i);
+        wrap(glad_glUniform1f, gl.uniform1f, countedUniform1f);
+        wrap(glad_glUniform2f, gl.uniform2f, countedUniform2f);
+        wrap(glad_glUniform3f, gl.uniform3f, countedUniform3f);
+        wrap(glad_glUniform4f, gl.uniform4f, countedUniform4f);
+        wrap(glad_glUniform2fv, gl.uniform2fv, countedUniform2fv);
+        wrap(glad_glUniform3fv, gl.uniform3fv, countedUniform3fv);
+        wrap(glad_glUniform4fv, gl.uniform4fv, countedUniform4fv);
+        wrap(glad_glUniformMatrix2fv, gl.uniformMatrix2fv, countedUniformMatrix2fv);
+        wrap(glad_glUniformMatrix3fv, gl.uniformMatrix3fv, countedUniformMatrix3fv);
+        wrap(glad_glUniformMatrix4fv, gl.uniformMatrix4fv, countedUniformMatrix4fv);
+        wrap(glad_glBufferData, gl.bufferData, countedBufferData);
+        wrap(glad_glBufferSubData, gl.bufferSubData, countedBufferSubData);
+        wrap(glad_glBufferStorage, gl.bufferStorage, countedBufferStorage);
+        wrap(glad_glTexImage2D, gl.texImage2D, countedTexImage2D);
+        wrap(glad_glTexImage3D, gl.texImage3D, countedTexImage3D);
+        wrap(glad_glTexSubImage2D, gl.texSubImage2D, countedTexSubImage2D);
+        wrap(glad_glTexSubImage3D, gl.texSubImage3D, countedTexSubImage3D);
+#endif
+    }
+
+    // Everything counted since install, passes take differences of these
+    const glCallCounts& totals() const {
+        return running;
+    }
+
+    // Call once at the end of every frame, closes the frame's counts
+    void endFrame() {
+        previousFrame = running - frameStart;
+        frameStart = running;
+    }
+
+    // Counts of the frame the last endFrame closed
+    const glCallCounts& lastFrame() const {
+        return previousFrame;
+    }
+
+    static const char* counterName(Gl_Call_Counter counter) {
+        static const char* names[CALL_COUNTER_COUNT] = { "draw calls", "program switches", "VAO binds", "texture binds", "uniform uploads", "upload bytes" };
+        return names[counter];
+    }
+
+    // snake_case names for the benchmark report
+    static const char* counterKey(Gl_Call_Counter counter) {
+        static const char* keys[CALL_COUNTER_COUNT] = { "draw_calls", "program_switches", "vao_binds", "texture_binds", "uniform_uploads", "upload_bytes" };
+        return keys[counter];
+    }
+
+private:
+    struct realGl {
+        PFNGLDRAWARRAYSPROC drawArrays;
+        PFNGLDRAWARRAYSINSTANCEDPROC drawArraysInstanced;
+        PFNGLDRAWELEMENTSPROC drawElements;
+        PFNGLDRAWELEMENTSBASEVERTEXPROC drawElementsBaseVertex;
+        PFNGLDRAWELEMENTSINSTANCEDPROC drawElementsInstanced;
+        PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC multiDrawElementsBaseVertex;
+        PFNGLUSEPROGRAMPROC useProgram;
+        PFNGLBINDVERTEXARRAYPROC bindVertexArray;
+        PFNGLBINDTEXTUREPROC bindTexture;
+        PFNGLBINDIMAGETEXTUREPROC bindImageTexture;
+        PFNGLUNIFORM1IPROC uniform1i;
+        PFNGLUNIFORM1FPROC uniform1f;
+        PFNGLUNIFORM2FPROC uniform2f;
+        PFNGLUNIFORM3FPROC uniform3f;
+        PFNGLUNIFORM4FPROC uniform4f;
+        PFNGLUNIFORM2FVPROC uniform2fv;
+        PFNGLUNIFORM3FVPROC uniform3fv;
+        PFNGLUNIFORM4FVPROC uniform4fv;
+        PFNGLUNIFORMMATRIX2FVPROC uniformMatrix2fv;
+        PFNGLUNIFORMMATRIX3FVPROC uniformMatrix3fv;
+        PFNGLUNIFORMMATRIX4FVPROC uniformMatrix4fv;
+        PFNGLBUFFERDATAPROC bufferData;
+        PFNGLBUFFERSUBDATAPROC bufferSubData;
+        PFNGLBUFFERSTORAGEPROC bufferStorage;
+        PFNGLTEXIMAGE2DPROC texImage2D;
+        PFNGLTEXIMAGE3DPROC texImage3D;
+        PFNGLTEXSUBIMAGE2DPROC texSubImage2D;
+        PFNGLTEXSUBIMAGE3DPROC texSubImage3D;
+    };
+
+    bool installed = false;
+    glCallCounts running;
+    glCallCounts frameStart;
+    glCallCounts previousFrame;
+
+    // the glad functions the wrappers forward to, zero initialized without a guard
+    static realGl& real() {
+        static realGl gl;
+        return gl;
+    }
+
+    template <typename Function>
+    static void wrap(Function& gladPointer, Function& realPointer, Function counted) {
+        if (gladPointer != nullptr) {
+            realPointer = gladPointer;
+            gladPointer = counted;
+        }
+    }
+
+    static void count(Gl_Call_Counter counter, uint64_t amount = 1);
+
+    // Bytes of client memory a glTex*Image call reads, rows are taken as tightly packed
+    static uint64_t imageBytes(GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type) {
+        uint64_t components = 4;
+        if (format == GL_RED || format == GL_RED_INTEGER || format == GL_DEPTH_COMPONENT || format == GL_STENCIL_INDEX) {
+            components = 1;
+        }
+        else if (format == GL_RG || format == GL_RG_INTEGER) {
+            components = 2;
+        }
+        else if (format == GL_RGB || format == GL_BGR || format == GL_RGB_INTEGER) {
+            components = 3;
+        }
+        uint64_t pixelBytes;
+        if (type == GL_UNSIGNED_BYTE || type == GL_BYTE) {
+            pixelBytes = components;
+        }
+        else if (type == GL_UNSIGNED_SHORT || type == GL_SHORT || type == GL_HALF_FLOAT) {
+            pixelBytes = components * 2;
+        }
+        else if (type == GL_UNSIGNED_INT || type == GL_INT || type == GL_FLOAT) {
+            pixelBytes = components * 4;
+        }
+        else {
+            pixelBytes = 4; // the packed types hold a whole pixel in one 16 or 32 bit value, taken as 32
+        }
+        return (uint64_t)width * height * depth * pixelBytes;
+    }
+
+    static void APIENTRY countedDrawArrays(GLenum mode, GLint first, GLsizei count) {
+        GlCallCounters::count(CALL_DRAWS);
+        real().drawArrays(mode, first, count);
+    }
+
+    static void APIENTRY countedDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances) {
+        GlCallCounters::count(CALL_DRAWS);
+        real().drawArraysInstanced(mode, first, count, instances);
+    }
+
+    static void APIENTRY countedDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices) {
+        GlCallCounters::count(CALL_DRAWS);
+        real().drawElements(mode, count, type, indices);
+    }
+
+    static void APIENTRY countedDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const void* indices, GLint baseVertex) {
+        GlCallCounters::count(CALL_DRAWS);
+        real().drawElementsBaseVertex(mode, count, type, indices, baseVertex);
+    }
+
+    static void APIENTRY countedDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instances) {
+        GlCallCounters::count(CALL_DRAWS);
+        real().drawElementsInstanced(mode, count, type, indices, instances);
+    }
+
+    static void APIENTRY countedMultiDrawElementsBaseVertex(GLenum mode, const GLsizei* count, GLenum type, const void* const* indices,
+        GLsizei drawCount, const GLint* baseVertex) {
+        GlCallCounters::count(CALL_DRAWS);
+        real().multiDrawElementsBaseVertex(mode, count, type, indices, drawCount, baseVertex);
+    }
+
+    static void APIENTRY countedUseProgram(GLuint program) {
+        GlCallCounters::count(CALL_PROGRAM_SWITCHES);
+        real().useProgram(program);
+    }
+
+    static void APIENTRY countedBindVertexArray(GLuint vertexArray) {
+        GlCallCounters::count(CALL_VAO_BINDS);
+        real().bindVertexArray(vertexArray);
+    }
+
+    static void APIENTRY countedBindTexture(GLenum target, GLuint texture) {
+        GlCallCounters::count(CALL_TEXTURE_BINDS);
+        real().bindTexture(target, texture);
+    }
+
+    static void APIENTRY countedBindImageTexture(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format) {
+        GlCallCounters::count(CALL_TEXTURE_BINDS);
+        real().bindImageTexture(unit, texture, level, layered, layer, access, format);
+    }
+
+    static void APIENTRY countedUniform1i(GLint location, GLint v0) {
+        GlCallCounters::count(CALL_UNIFORM_UPLOADS);
+        real().uniform1i(location, v0);
+    }
+
+    static void APIENTRY countedUniform1f(GLint location, GLfloat v0) {
+        GlCallCounters::count(CALL_UNIFORM_UPLOADS);
+        real().uniform1f(location, v0);
+    }
+
+    static void APIENTRY countedUniform2f(GLint location, GLfloat v0, GLfloat v1) {
+        GlCallCounters::count(CALL_UNIFORM_UPLOADS);
+        real().uniform2f(location, v0, v1);
+    }
+
+    static void APIENTRY countedUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2) {
+        GlCallCounters::count(CALL_UNIFORM_UPLOADS);
+        real().uniform3f(location, v0, v1, v2);
+    }
+
+    static void APIENTRY countedUniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3) {
+        GlCallCounters::count(CALL_UNIFORM_UPLOADS);
+        real().uniform4f(location, v0, v1, v2, v3);
+    }
+
+    static void APIENTRY countedUniform2fv(GLint location, GLsizei count, const GLfloat* value) {
+        GlCallCounters::count(CALL_UNIFORM_UPLOADS);
+        real().uniform2fv(location, count, value);
+    }
+
+    static void APIENTRY countedUniform3fv(GLint location, GLsizei count, const GLfloat* value) {
+        GlCallCounters::count(CALL_UNIFORM_UPLOADS);
+        real().uniform3fv(location, count, value);
+    }
+
+    static void APIENTRY countedUniform4fv(GLint location, GLsizei count, const GLfloat* value) {
+        GlCallCounters::count(CALL_UNIFORM_UPLOADS);
+        real().uniform4fv(location, count, value);
+    }
+
+    static void APIENTRY countedUniformMatrix2fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) {
+        GlCallCounters::count(CALL_UNIFORM_UPLOADS);
+        real().uniformMatrix2fv(location, count, transpose, value);
+    }
+
+    static void APIENTRY countedUniformMatrix3fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) {
+        GlCallCounters::count(CALL_UNIFORM_UPLOADS);
+        real().uniformMatrix3fv(location, count, transpose, value);
+    }
+
+    static void APIENTRY countedUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) {
+        GlCallCounters::count(CALL_UNIFORM_UPLOADS);
+        real().uniformMatrix4fv(location, count, transpose, value);
+    }
+
+    static void APIENTRY countedBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage) {
+        if (data != nullptr) {
+            GlCallCounters::count(CALL_UPLOAD_BYTES, (uint64_t)size);
+        }
+        real().bufferData(target, size, data, usage);
+    }
+
+    static void APIENTRY countedBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data) {
+        GlCallCounters::count(CALL_UPLOAD_BYTES, (uint64_t)size);
+        real().bufferSubData(target, offset, size, data);
+    }
+
+    static void APIENTRY countedBufferStorage(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags) {
+        if (data != nullptr) {
+            GlCallCounters::count(CALL_UPLOAD_BYTES, (uint64_t)size);
+        }
+        real().bufferStorage(target, size, data, flags);
+    }
+
+    static void APIENTRY countedTexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border,
+        GLenum format, GLenum type, const void* pixels) {
+        if (pixels != nullptr) {
+            GlCallCounters::count(CALL_UPLOAD_BYTES, imageBytes(width, height, 1, format, type));
+        }
+        real().texImage2D(target, level, internalFormat, width, height, border, format, type, pixels);
+    }
+
+    static void APIENTRY countedTexImage3D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLsizei depth,
+        GLint border, GLenum format, GLenum type, const void* pixels) {
+        if (pixels != nullptr) {
+            GlCallCounters::count(CALL_UPLOAD_BYTES, imageBytes(width, height, depth, format, type));
+        }
+        real().texImage3D(target, level, internalFormat, width, height, depth, border, format, type, pixels);
+    }
+
+    static void APIENTRY countedTexSubImage2D(GLenum target, GLint level, GLint xOffset, GLint yOffset, GLsizei width, GLsizei height,
+        GLenum format, GLenum type, const void* pixels) {
+        GlCallCounters::count(CALL_UPLOAD_BYTES, imageBytes(width, height, 1, format, type));
+        real().texSubImage2D(target, level, xOffset, yOffset, width, height, format, type, pixels);
+    }
+
+    static void APIENTRY countedTexSubImage3D(GLenum target, GLint level, GLint xOffset, GLint yOffset, GLint zOffset, GLsizei width,
+        GLsizei height, GLsizei depth, GLenum format, GLenum type, const void* pixels) {
+        GlCallCounters::count(CALL_UPLOAD_BYTES, imageBytes(width, height, depth, format, type));
+        real().texSubImage3D(target, level, xOffset, yOffset, zOffset, width, height, depth, format, type, pixels);
+    }
+};
+
+// The process wide counters the GL wrappers report to
+inline GlCallCounters& glCallCounters() {
+    static GlCallCounters counters;
+    return counters;
+}
+
+inline void GlCallCounters::count(Gl_Call_Counter counter, uint64_t amount) {
+    glCallCounters().running.value[counter] += amount;
+}
@@ -0,0 +1,108 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <direct.h>
+#include <cerrno>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path, size_t size, bool discard) {
+    close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+        discard ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    // a mapping larger than the file grows it, the new bytes read as zero
+    unsigned long long mappingSize = size;
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, (DWORD)(mappingSize >> 32), (DWORD)(mappingSize & 0xFFFFFFFF), nullptr);
+    if (mapping == nullptr) {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* mapped = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (mapped == nullptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    fileHandle = file;
+    mappingHandle = mapping;
+    view = (unsigned char*)mapped;
+    mappedSize = size;
+    return true;
+}
+
+void MappedFile::close() {
+    if (view != nullptr) {
+        UnmapViewOfFile(view);
+        CloseHandle((HANDLE)mappingHandle);
+        CloseHandle((HANDLE)fileHandle);
+    }
+    view = nullptr;
+    mappedSize = 0;
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+}
+
+bool MappedFile::createDirectory(const std::string& path) {
+    return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+}
+
+#else
+
+bool MappedFile::open(const std::string& path, size_t size, bool discard) {
+    close();
+    int file = ::open(path.c_str(), O_RDWR | O_CREAT | (discard ? O_TRUNC : 0), 0644);
+    if (file < 0) {
+        return false;
+    }
+
+    // ftruncate grows the file sparsely, untouched records cost no disk space
+    struct stat status;
+    if (fstat(file, &status) != 0 || ((size_t)status.st_size < size && ftruncate(file, (off_t)size) != 0)) {
+        ::close(file);
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    ::close(file); // the mapping keeps its own reference
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    view = (unsigned char*)mapped;
+    mappedSize = size;
+    return true;
+}
+
+void MappedFile::close() {
+    if (view != nullptr) {
+        munmap(view, mappedSize);
+    }
+    view = nullptr;
+    mappedSize = 0;
+}
+
+bool MappedFile::createDirectory(const std::string& path) {
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+// Read/write memory mapping of a whole file, Windows or POSIX. The platform headers stay in mappedfile.cpp
+// so windows.h's macros don't leak into everything that includes the terrain.
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    ~MappedFile() {
+        close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Maps the first size bytes of path, creating the file or growing it with zeroes as needed.
+    // discard truncates whatever was there first. Returns false and leaves nothing mapped on failure.
+    bool open(const std::string& path, size_t size, bool discard);
+
+    // Unmaps the view, the OS writes dirty pages back to the file
+    void close();
+
+    unsigned char* data() const {
+        return view;
+    }
+
+    size_t size() const {
+        return mappedSize;
+    }
+
+    bool isOpen() const {
+        return view != nullptr;
+    }
+
+    // Creates a single directory level, true if it exists afterwards
+    static bool createDirectory(const std::string& path);
+
+private:
+    unsigned char* view = nullptr;
+    size_t mappedSize = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstddef>
+
+#include <glad/glad.h>
+
+#include "imgui.h"
+
+enum Cpu_Memory_Category {
+    CPU_CHUNK_VERTICES,
+    CPU_CHUNK_INDICES,
+    CPU_CHUNK_HEIGHTFIELDS,
+    CPU_CHUNK_RECORDS,      // the terrainChunk structs themselves
+    CPU_TEXTURES,           // decoded images and CPU copies of texture data
+    CPU_MAPPED_CACHE,       // disk cache regions mapped into the address space, the OS pages them in and out
+    CPU_CATEGORY_COUNT
+};
+
+enum Gpu_Object_Type {
+    GPU_BUFFER,
+    GPU_TEXTURE,
+    GPU_VERTEX_ARRAY,
+    GPU_FRAMEBUFFER,
+    GPU_QUERY,
+    GPU_OBJECT_TYPE_COUNT
+};
+
+// Memory the engine holds, CPU bytes by category and GPU bytes per buffer and texture, with high-water marks and the
+// number of live GL objects. Everything is reported by the code that allocates it: GL objects as they are generated,
+// given storage and deleted, CPU categories as totals from whoever owns them (the terrain recomputes its chunk totals
+// every frame). GPU bytes are the sizes our code asked for, drivers may pad or compress them.
+// Safe to query from any thread, updates come from the render thread.
+class MemoryStats {
+public:
+    struct gpuAllocation {
+        Gpu_Object_Type type;
+        GLuint name;
+        std::string label;
+        size_t bytes;
+    };
+
+    MemoryStats() = default;
+    MemoryStats(const MemoryStats&) = delete;
+    MemoryStats& operator=(const MemoryStats&) = delete;
+
+    // CPU categories owned in one place are set as a total, ones filled from several places are adjusted
+    void setCpuBytes(Cpu_Memory_Category category, size_t bytes) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        cpu[category] = bytes;
+        updateCpuHighWater(category);
+    }
+
+    void addCpuBytes(Cpu_Memory_Category category, size_t bytes) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        cpu[category] += bytes;
+        updateCpuHighWater(category);
+    }
+
+    void subtractCpuBytes(Cpu_Memory_Category category, size_t bytes) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        cpu[category] -= std::min(bytes, cpu[category]);
+    }
+
+    // Call after glGen*
+    void created(Gpu_Object_Type type, GLsizei count) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        liveObjects[type] += count;
+        objectHighWater[type] = std::max(objectHighWater[type], liveObjects[type]);
+    }
+
+    // Call after glDelete* with the same names, their storage stops counting. Names of 0 are ignored like GL does.
+    void deleted(Gpu_Object_Type type, GLsizei count, const GLuint* names) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        for (GLsizei i = 0; i < count; i++) {
+            if (names[i] == 0) {
+                continue;
+            }
+            liveObjects[type]--;
+            auto allocation = allocations.find(std::make_pair(type, names[i]));
+            if (allocation != allocations.end()) {
+                gpu[type] -= allocation->second.bytes;
+                allocations.erase(allocation);
+            }
+        }
+    }
+
+    // Call after giving a buffer or texture storage, replaces whatever size it had before (glBufferData re-specifying a stream buffer)
+    void allocated(Gpu_Object_Type type, GLuint name, const char* label, size_t bytes) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        std::pair<Gpu_Object_Type, GLuint> key(type, name);
+        auto allocation = allocations.find(key);
+        if (allocation == allocations.end()) {
+            allocation = allocations.emplace(key, gpuAllocation{ type, name, label, 0 }).first;
+        }
+        gpu[type] += bytes;
+        gpu[type] -= allocation->second.bytes;
+        allocation->second.bytes = bytes;
+        allocation->second.label = label;
+        gpuHighWater[type] = std::max(gpuHighWater[type], gpu[type]);
+        gpuTotalHighWater = std::max(gpuTotalHighWater, totalGpuBytesLocked());
+    }
+
+    size_t cpuBytes(Cpu_Memory_Category category) const {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return cpu[category];
+    }
+
+    size_t cpuHighWater(Cpu_Memory_Category category) const {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return cpuHighWaterMarks[category];
+    }
+
+    size_t totalCpuBytes() const {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return totalCpuBytesLocked();
+    }
+
+    size_t totalCpuHighWater() const {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return cpuTotalHighWater;
+    }
+
+    size_t gpuBytes(Gpu_Object_Type type) const {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return gpu[type];
+    }
+
+    size_t gpuHighWaterBytes(Gpu_Object_Type type) const {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return gpuHighWater[type];
+    }
+
+    size_t totalGpuBytes() const {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return totalGpuBytesLocked();
+    }
+
+    size_t totalGpuHighWater() const {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return gpuTotalHighWater;
+    }
+
+    int liveObjectCount(Gpu_Object_Type type) const {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return liveObjects[type];
+    }
+
+    int liveObjectHighWater(Gpu_Object_Type type) const {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return objectHighWater[type];
+    }
+
+    // Every buffer and texture with storage, largest first
+    std::vector<gpuAllocation> gpuAllocations() const {
+        std::vector<gpuAllocation> list;
+        {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            for (const auto& allocation : allocations) {
+                list.push_back(allocation.second);
+            }
+        }
+        std::sort(list.begin(), list.end(), [](const gpuAllocation& a, const gpuAllocation& b) {
+            return a.bytes > b.bytes;
+            });
+        return list;
+    }
+
+    // Bytes of a width x height x layers texture with texelBytes per texel, mipmapped adds every smaller level
+    static size_t textureBytes(int width, int height, int layers, int texelBytes, bool mipmapped) {
+        size_t bytes = 0;
+        while (true) {
+            bytes += (size_t)width * height * layers * texelBytes;
+            if (!mipmapped || (width == 1 && height == 1)) {
+                return bytes;
+            }
+            width = std::max(width / 2, 1);
+            height = std::max(height / 2, 1);
+        }
+    }
+
+    static const char* cpuCategoryName(Cpu_Memory_Category category) {
+        static const char* names[CPU_CATEGORY_COUNT] = { "chunk vertices", "chunk indices", "chunk heightfields", "chunk records", "textures", "mapped disk cache" };
+        return names[category];
+    }
+
+    static const char* gpuTypeName(Gpu_Object_Type type) {
+        static const char* names[GPU_OBJECT_TYPE_COUNT] = { "buffers", "textures", "vertex arrays", "framebuffers", "queries" };
+        return names[type];
+    }
+
+    // Current and high-water bytes and the per object list, goes inside whatever ImGui window is open
+    void drawOverlay() const {
+        if (!ImGui::CollapsingHeader("Memory")) {
+            return;
+        }
+        const float MB = 1024.0f * 1024.0f;
+        ImGui::Text("CPU %.2f MB, peak %.2f MB", totalCpuBytes() / MB, totalCpuHighWater() / MB);
+        for (int category = 0; category < CPU_CATEGORY_COUNT; category++) {
+            Cpu_Memory_Category cpuCategory = (Cpu_Memory_Category)category;
+            ImGui::BulletText("%s: %.2f MB, peak %.2f MB", cpuCategoryName(cpuCategory), cpuBytes(cpuCategory) / MB, cpuHighWater(cpuCategory) / MB);
+        }
+        ImGui::Text("GPU %.2f MB, peak %.2f MB", totalGpuBytes() / MB, totalGpuHighWater() / MB);
+        for (int type = 0; type < GPU_OBJECT_TYPE_COUNT; type++) {
+            Gpu_Object_Type gpuType = (Gpu_Object_Type)type;
+            ImGui::BulletText("%s: %i live, peak %i, %.2f MB, peak %.2f MB", gpuTypeName(gpuType), liveObjectCount(gpuType),
+                liveObjectHighWater(gpuType), gpuBytes(gpuType) / MB, gpuHighWaterBytes(gpuType) / MB);
+        }
+        if (ImGui::TreeNode("GPU allocations")) {
+            for (const gpuAllocation& allocation : gpuAllocations()) {
+                ImGui::Text("%-28s %-8s %6u %10.1f KB", allocation.label.c_str(), allocation.type == GPU_BUFFER ? "buffer" : "texture",
+                    allocation.name, allocation.bytes / 1024.0f);
+            }
+            ImGui::TreePop();
+        }
+    }
+
+private:
+    mutable std::mutex statsMutex;
+    size_t cpu[CPU_CATEGORY_COUNT] = {};
+    size_t cpuHighWaterMarks[CPU_CATEGORY_COUNT] = {};
+    size_t cpuTotalHighWater = 0;
+    size_t gpu[GPU_OBJECT_TYPE_COUNT] = {};
+    size_t gpuHighWater[GPU_OBJECT_TYPE_COUNT] = {};
+    size_t gpuTotalHighWater = 0;
+    int liveObjects[GPU_OBJECT_TYPE_COUNT] = {};
+    int objectHighWater[GPU_OBJECT_TYPE_COUNT] = {};
+    std::map<std::pair<Gpu_Object_Type, GLuint>, gpuAllocation> allocations;
+
+    void updateCpuHighWater(Cpu_Memory_Category category) {
+        cpuHighWaterMarks[category] = std::max(cpuHighWaterMarks[category], cpu[category]);
+        cpuTotalHighWater = std::max(cpuTotalHighWater, totalCpuBytesLocked());
+    }
+
+    size_t totalCpuBytesLocked() const {
+        size_t total = 0;
+        for (size_t bytes : cpu) {
+            total += bytes;
+        }
+        return total;
+    }
+
+    size_t totalGpuBytesLocked() const {
+        size_t total = 0;
+        for (size_t bytes : gpu) {
+            total += bytes;
+        }
+        return total;
+    }
+};
+
+// The process wide statistics every allocation site reports to
+inline MemoryStats& memoryStats() {
+    static MemoryStats stats;
+    return stats;
+}
@@ -1,9 +1,14 @@
-#version 450
+#version 430 core
 
-layout (local_size_x = 32, local_size_y = 32) in;
+// Normals for one layer of the heightmap array written by heightmap.glsl, see HeightmapCompute in terraincompute.h.
+// Image x runs along world z and image y along world x, the same layout as the CPU heightfield.
+layout (local_size_x = 16, local_size_y = 16) in;
 
-layout (binding=0, rgba8) uniform image2D heightmap;
-layout (binding=1, rgba8) uniform image2D normalmap;
+layout (binding=0, r32f) uniform readonly image2D heightmap;
+layout (binding=1, rgba8) uniform writeonly image2D normalmap;
+
+uniform int size;       // texels per side
+uniform float spacing;  // world distance between texels
 
 shared float local_neighborhood[gl_WorkGroupSize.x+2][gl_WorkGroupSize.y+2];
 
@@ -20,9 +25,10 @@ void sobel_operator()
     float center_left = local_neighborhood[local_pixel.x - 1][local_pixel.y];
     float bottom_left = local_neighborhood[local_pixel.x - 1][local_pixel.y - 1];
 
-    float dx = (top_right + 2 * center_right + bottom_right) - (top_left + 2 * center_left + bottom_left);
-    float dy = (bottom_left + 2 * bottom + bottom_right)  - (top_left + 2 * top + top_right);
-    vec3 normal = normalize(vec3(dx, dy, 0.1));
+    // slopes along the image axes in world units, the kernel weights add up to 4 on each side of a 2 texel span
+    float dx = ((top_right + 2 * center_right + bottom_right) - (top_left + 2 * center_left + bottom_left)) / (8.0 * spacing);
+    float dy = ((top_left + 2 * top + top_right) - (bottom_left + 2 * bottom + bottom_right)) / (8.0 * spacing);
+    vec3 normal = normalize(vec3(-dy, 1.0, -dx)); // image y is world x, image x is world z
     vec3 rgb_normal = (normal + 1.0) / 2.0;
     imageStore(normalmap, ivec2(gl_GlobalInvocationID.xy), vec4(rgb_normal, 1.0));
 }
@@ -32,11 +38,11 @@ void main()
     uvec2 local_pixel = gl_LocalInvocationID.xy + uvec2(1, 1);
     ivec2 global_pixel = ivec2(gl_GlobalInvocationID.xy);
 
-    // Store the current pixel on shared memory
-    local_neighborhood[local_pixel.x][local_pixel.y] = imageLoad(heightmap, ivec2(global_pixel.x, global_pixel.y)).r;
-
     ivec2 local_size = ivec2(gl_WorkGroupSize.xy);
-    ivec2 image_size = ivec2(gl_WorkGroupSize.xy * gl_NumWorkGroups.xy);
+    ivec2 image_size = ivec2(size);
+
+    // Store the current pixel on shared memory, invocations past the edge still fill their tile entry for the barrier
+    local_neighborhood[local_pixel.x][local_pixel.y] = imageLoad(heightmap, clamp(global_pixel, ivec2(0), image_size - 1)).r;
     if (local_pixel.x == 1) // left-block-edge
     {
         ivec2 left_global_pixel = clamp(global_pixel + ivec2(-1, 0), ivec2(0), image_size - 1);
@@ -85,5 +91,7 @@ void main()
 
     barrier();
 
-    sobel_operator();
+    if (global_pixel.x < image_size.x && global_pixel.y < image_size.y) {
+        sobel_operator();
+    }
 }
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <cstdio>
+
+#include <glad/glad.h>
+
+#include "imgui.h"
+#include "memorystats.h"
+#include "glcounters.h"
+#include "trace.h"
+
+// Per-frame timings of the render loop's passes. CPU time comes from steady_clock around each pass, GPU time from
+// GL_TIME_ELAPSED queries issued around the same calls. Query results are read QUERY_FRAMES frames after they were
+// issued so the driver has long finished them and reading never stalls the pipeline; a result that still isn't ready
+// is dropped rather than waited on. GL_TIME_ELAPSED queries can't nest, GPU timed passes must not overlap.
+// While tracing is on every begin/end pair is also a trace event named after its section. Each section also keeps the
+// GL calls made between its begin and end (see glcounters.h), a section inside another counts in both.
+class FrameProfiler {
+public:
+    static const int HISTORY_FRAMES = 240;
+    static const int QUERY_FRAMES = 3;
+
+    FrameProfiler() = default;
+
+    ~FrameProfiler() {
+        for (section& timed : sections) {
+            for (std::vector<GLuint>& queries : timed.queries) {
+                if (!queries.empty()) {
+                    glDeleteQueries((GLsizei)queries.size(), queries.data());
+                    memoryStats().deleted(GPU_QUERY, (GLsizei)queries.size(), queries.data());
+                }
+            }
+        }
+    }
+
+    FrameProfiler(const FrameProfiler&) = delete;
+    FrameProfiler& operator=(const FrameProfiler&) = delete;
+
+    // Registers a pass, the returned index is what begin/end take. gpu adds the GL_TIME_ELAPSED timing.
+    int addSection(const std::string& name, bool gpu) {
+        section timed;
+        timed.name = name;
+        timed.traceName = Tracer::instance().intern(name);
+        timed.gpu = gpu;
+        timed.cpuHistory.assign(HISTORY_FRAMES, 0.0f);
+        timed.gpuHistory.assign(HISTORY_FRAMES, 0.0f);
+        timed.queries.resize(QUERY_FRAMES);
+        timed.queriesUsed.assign(QUERY_FRAMES, 0);
+        sections.push_back(timed);
+        return (int)sections.size() - 1;
+    }
+
+    // Call once at the top of the frame, closes the last frame's CPU times and collects the GPU times from QUERY_FRAMES ago
+    void beginFrame() {
+        if (frame > 0) {
+            for (section& timed : sections) {
+                timed.cpuHistory[cpuCursor] = (float)timed.cpuMilliseconds;
+            }
+            cpuCursor = (cpuCursor + 1) % HISTORY_FRAMES;
+            cpuFrames = std::min(cpuFrames + 1, HISTORY_FRAMES);
+        }
+        for (section& timed : sections) {
+            timed.cpuMilliseconds = 0.0;
+            if (frame > 0) {
+                timed.lastFrameCalls = timed.frameCalls;
+            }
+            timed.frameCalls = glCallCounts();
+        }
+
+        querySlot = (int)(frame % QUERY_FRAMES);
+        if (frame >= QUERY_FRAMES) {
+            collectGpuTimes();
+        }
+        for (section& timed : sections) {
+            timed.queriesUsed[querySlot] = 0;
+        }
+        frame++;
+    }
+
+    // A section can be begun and ended more than once a frame, its times add up
+    void begin(int index) {
+        section& timed = sections[index];
+        timed.start = std::chrono::steady_clock::now();
+        timed.callsAtBegin = glCallCounters().totals();
+        if (timed.gpu) {
+            std::vector<GLuint>& queries = timed.queries[querySlot];
+            int& used = timed.queriesUsed[querySlot];
+            if (used == (int)queries.size()) {
+                GLuint query;
+                glGenQueries(1, &query);
+                memoryStats().created(GPU_QUERY, 1);
+                queries.push_back(query);
+            }
+            glBeginQuery(GL_TIME_ELAPSED, queries[used++]);
+        }
+    }
+
+    void end(int index) {
+        section& timed = sections[index];
+        if (timed.gpu) {
+            glEndQuery(GL_TIME_ELAPSED);
+        }
+        timed.frameCalls += glCallCounters().totals() - timed.callsAtBegin;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        timed.cpuMilliseconds += std::chrono::duration<double, std::milli>(now - timed.start).count();
+        if (Tracer::enabled()) {
+            Tracer::instance().record(timed.traceName, nanoseconds(timed.start), nanoseconds(now));
+        }
+    }
+
+    // CPU time measured somewhere else this frame, the generation threads' time for instance
+    void addCpuTime(int index, double milliseconds) {
+        sections[index].cpuMilliseconds += milliseconds;
+    }
+
+    int sectionCount() const {
+        return (int)sections.size();
+    }
+
+    const std::string& sectionName(int index) const {
+        return sections[index].name;
+    }
+
+    // GL calls the section has made so far this frame
+    const glCallCounts& frameCalls(int index) const {
+        return sections[index].frameCalls;
+    }
+
+    // Rolling graph and p50/p95/p99 of every section and the last frame's GL calls, goes inside whatever ImGui window is open
+    void drawOverlay() {
+        if (!ImGui::CollapsingHeader("Profiler")) {
+            return;
+        }
+        ImGui::Text("milliseconds over the last %i frames, p50 / p95 / p99", cpuFrames);
+        for (section& timed : sections) {
+            drawHistory(timed.name + " CPU", timed.cpuHistory, cpuCursor, cpuFrames);
+            if (timed.gpu) {
+                drawHistory(timed.name + " GPU", timed.gpuHistory, timed.gpuCursor, timed.gpuFrames);
+            }
+        }
+        drawCallCounts();
+    }
+
+private:
+    struct section {
+        std::string name;
+        const char* traceName = nullptr;
+        bool gpu = false;
+        std::chrono::steady_clock::time_point start;
+        double cpuMilliseconds = 0.0;
+        glCallCounts callsAtBegin;
+        glCallCounts frameCalls;
+        glCallCounts lastFrameCalls;
+        std::vector<float> cpuHistory;
+        std::vector<float> gpuHistory;
+        int gpuCursor = 0;
+        int gpuFrames = 0;
+        std::vector<std::vector<GLuint>> queries; // per query slot, grows to the most begin calls in a frame
+        std::vector<int> queriesUsed;
+    };
+
+    std::vector<section> sections;
+    uint64_t frame = 0;
+    int querySlot = 0;
+    int cpuCursor = 0;  // next history entry, the same for every section's CPU history
+    int cpuFrames = 0;
+    std::vector<float> sorted;
+
+    static int64_t nanoseconds(std::chrono::steady_clock::time_point time) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    // the queries in querySlot were issued QUERY_FRAMES frames ago
+    void collectGpuTimes() {
+        for (section& timed : sections) {
+            if (!timed.gpu) {
+                continue;
+            }
+            GLuint64 total = 0;
+            bool ready = true;
+            for (int q = 0; q < timed.queriesUsed[querySlot]; q++) {
+                GLuint query = timed.queries[querySlot][q];
+                GLint available = 0;
+                glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available) {
+                    ready = false;
+                    break;
+                }
+                GLuint64 elapsed = 0;
+                glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+                total += elapsed;
+            }
+            if (!ready) {
+                continue;
+            }
+            timed.gpuHistory[timed.gpuCursor] = (float)(total / 1.0e6);
+            timed.gpuCursor = (timed.gpuCursor + 1) % HISTORY_FRAMES;
+            timed.gpuFrames = std::min(timed.gpuFrames + 1, HISTORY_FRAMES);
+        }
+    }
+
+    float percentile(float fraction) const {
+        if (sorted.empty()) {
+            return 0.0f;
+        }
+        size_t index = std::min(sorted.size() - 1, (size_t)(fraction * sorted.size()));
+        return sorted[index];
+    }
+
+    void drawCallCounts() const {
+        if (!ImGui::TreeNode("GL calls last frame")) {
+            return;
+        }
+        if (!GlCallCounters::compiledIn()) {
+            ImGui::Text("compiled out with GL_CALL_COUNTERS_DISABLED");
+        }
+        else if (ImGui::BeginTable("glCalls", CALL_COUNTER_COUNT + 1, ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit)) {
+            ImGui::TableSetupColumn("pass");
+            for (int counter = 0; counter < CALL_COUNTER_COUNT; counter++) {
+                ImGui::TableSetupColumn(GlCallCounters::counterName((Gl_Call_Counter)counter));
+            }
+            ImGui::TableHeadersRow();
+            auto row = [](const char* name, const glCallCounts& calls) {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(name);
+                for (uint64_t value : calls.value) {
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%llu", (unsigned long long)value);
+                }
+            };
+            row("whole frame", glCallCounters().lastFrame());
+            for (const section& timed : sections) {
+                row(timed.name.c_str(), timed.lastFrameCalls);
+            }
+            ImGui::EndTable();
+        }
+        ImGui::TreePop();
+    }
+
+    void drawHistory(const std::string& label, const std::vector<float>& history, int cursor, int frames) {
+        // oldest first once the ring has wrapped
+        int offset = frames < HISTORY_FRAMES ? 0 : cursor;
+        sorted.assign(history.begin(), history.begin() + frames);
+        std::sort(sorted.begin(), sorted.end());
+        char overlay[64];
+        snprintf(overlay, sizeof(overlay), "%.2f / %.2f / %.2f", percentile(0.5f), percentile(0.95f), percentile(0.99f));
+        ImGui::PlotLines(label.c_str(), history.data(), frames, offset, overlay, 0.0f, FLT_MAX, ImVec2(0.0f, 40.0f));
+    }
+};
+
+// Times the enclosing block as one of profiler's sections
+class ProfileScope {
+public:
+    ProfileScope(FrameProfiler& profiler, int section) : profiler(profiler), section(section) {
+        profiler.begin(section);
+    }
+
+    ~ProfileScope() {
+        profiler.end(section);
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    FrameProfiler& profiler;
+    int section;
+};
@@ -8,6 +8,8 @@
 #include <sstream>
 #include <iostream>
 
+#include "trace.h"
+
 /*
 Personal Notes
 
@@ -22,6 +24,7 @@ public:
 
 	/* Reads and builds the shader */
 	Shader(const char* vertexPath, const char* fragmentPath) {
+		TRACE_SCOPE("load shader");
 		/*1 Retrieve vertex/fragment code from file path*/
 		std::string vertexCode;
 		std::string fragmentCode;
@@ -102,6 +105,40 @@ public:
 		free(infoLog);
 	}
 
+	/* Reads and builds a shader with tessellation control and evaluation stages, needs a 4.0+ context */
+	Shader(const char* vertexPath, const char* tessControlPath, const char* tessEvaluationPath, const char* fragmentPath) {
+		TRACE_SCOPE("load shader");
+		unsigned int stages[4] = {
+			compileStage(GL_VERTEX_SHADER, vertexPath, "VERTEX"),
+			compileStage(GL_TESS_CONTROL_SHADER, tessControlPath, "TESS_CONTROL"),
+			compileStage(GL_TESS_EVALUATION_SHADER, tessEvaluationPath, "TESS_EVALUATION"),
+			compileStage(GL_FRAGMENT_SHADER, fragmentPath, "FRAGMENT")
+		};
+
+		ID = glCreateProgram();
+		for (unsigned int stage : stages) {
+			glAttachShader(ID, stage);
+		}
+		glLinkProgram(ID);
+		checkCompileErrors(ID, "PROGRAM");
+
+		for (unsigned int stage : stages) {
+			glDeleteShader(stage);
+		}
+	}
+
+	/* Reads and builds a compute shader, needs a 4.3+ context */
+	explicit Shader(const char* computePath) {
+		TRACE_SCOPE("load shader");
+		unsigned int compute = compileStage(GL_COMPUTE_SHADER, computePath, "COMPUTE");
+
+		ID = glCreateProgram();
+		glAttachShader(ID, compute);
+		glLinkProgram(ID);
+		checkCompileErrors(ID, "PROGRAM");
+		glDeleteShader(compute);
+	}
+
 	/* Use the shader */
 	void use() const
 	{
@@ -157,6 +194,45 @@ public:
 	}
 
 private:
+	/* Reads one stage's file and compiles it, errors are printed and the shader is returned anyway like the constructor above */
+	unsigned int compileStage(GLenum type, const char* path, const std::string& name) {
+		std::cout << "Loading " << name << " shader file: " << path << std::endl;
+		std::string code = readSource(path);
+
+		const char* shaderCode = code.c_str();
+		unsigned int shader = glCreateShader(type);
+		glShaderSource(shader, 1, &shaderCode, NULL);
+		glCompileShader(shader);
+		checkCompileErrors(shader, name);
+		return shader;
+	}
+
+	/* Reads a file, replacing "#include file" lines with the contents of file (relative to the including file), GLSL has no includes of its own */
+	std::string readSource(const std::string& path) {
+		std::ifstream shaderFile(path);
+		if (!shaderFile) {
+			std::cout << "ERROR SHADER FILE NOT SUCCESSFULLY READ " << path << std::endl;
+			return std::string();
+		}
+
+		std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+		std::stringstream source;
+		std::string line;
+		while (std::getline(shaderFile, line)) {
+			size_t start = line.find_first_not_of(" \t");
+			if (start != std::string::npos && line.compare(start, 8, "#include") == 0) {
+				std::string file = line.substr(start + 8);
+				file.erase(0, file.find_first_not_of(" \t\"<"));
+				file.erase(file.find_last_not_of(" \t\r\">") + 1);
+				source << readSource(directory + file) << "\n";
+			}
+			else {
+				source << line << "\n";
+			}
+		}
+		return source.str();
+	}
+
 	void checkCompileErrors(unsigned int shader, std::string type) {
 		int success;
 		char* infoLog = (char*)malloc(sizeof(char*) * 1024);
@@ -168,7 +244,7 @@ private:
 			}
 		}
 		else {
-			glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+			glGetProgramiv(shader, GL_LINK_STATUS, &success);
 			if (!success) {
 				glGetProgramInfoLog(shader, 1024, NULL, infoLog);
 				std::cout << "ERROR PROGRAM LINKING ERROR of type " << type << "\n" << infoLog << std::endl;
@@ -0,0 +1,93 @@
+// GLSL port of SimplexNoise::noise(x, y) and SimplexNoise::fractal(octaves, x, y) from SimplexNoise.cpp.
+// Same permutation table, gradients and scaling so heights generated on the GPU match the CPU ones to float rounding.
+// noise.glsl is a different (hexagonal lattice) simplex noise and can't be used where the two have to agree.
+
+const int perm[256] = int[256](
+    151, 160, 137, 91, 90, 15, 131, 13, 201, 95, 96, 53, 194, 233, 7, 225,
+    140, 36, 103, 30, 69, 142, 8, 99, 37, 240, 21, 10, 23, 190, 6, 148,
+    247, 120, 234, 75, 0, 26, 197, 62, 94, 252, 219, 203, 117, 35, 11, 32,
+    57, 177, 33, 88, 237, 149, 56, 87, 174, 20, 125, 136, 171, 168, 68, 175,
+    74, 165, 71, 134, 139, 48, 27, 166, 77, 146, 158, 231, 83, 111, 229, 122,
+    60, 211, 133, 230, 220, 105, 92, 41, 55, 46, 245, 40, 244, 102, 143, 54,
+    65, 25, 63, 161, 1, 216, 80, 73, 209, 76, 132, 187, 208, 89, 18, 169,
+    200, 196, 135, 130, 116, 188, 159, 86, 164, 100, 109, 198, 173, 186, 3, 64,
+    52, 217, 226, 250, 124, 123, 5, 202, 38, 147, 118, 126, 255, 82, 85, 212,
+    207, 206, 59, 227, 47, 16, 58, 17, 182, 189, 28, 42, 223, 183, 170, 213,
+    119, 248, 152, 2, 44, 154, 163, 70, 221, 153, 101, 155, 167, 43, 172, 9,
+    129, 22, 39, 253, 19, 98, 108, 110, 79, 113, 224, 232, 178, 185, 112, 104,
+    218, 246, 97, 228, 251, 34, 242, 193, 238, 210, 144, 12, 191, 179, 162, 241,
+    81, 51, 145, 235, 249, 14, 239, 107, 49, 192, 214, 31, 181, 199, 106, 157,
+    184, 84, 204, 176, 115, 121, 50, 45, 127, 4, 150, 254, 138, 236, 205, 93,
+    222, 114, 67, 29, 24, 72, 243, 141, 128, 195, 78, 66, 215, 61, 156, 180
+);
+
+int hash(int i) {
+    return perm[i & 255];
+}
+
+float grad(int hash, float x, float y) {
+    int h = hash & 0x3F;
+    float u = h < 4 ? x : y;
+    float v = h < 4 ? y : x;
+    return ((h & 1) != 0 ? -u : u) + ((h & 2) != 0 ? -2.0 * v : 2.0 * v);
+}
+
+float simplexNoise(float x, float y) {
+    const float F2 = 0.366025403;
+    const float G2 = 0.211324865;
+
+    float s = (x + y) * F2;
+    int i = int(floor(x + s));
+    int j = int(floor(y + s));
+
+    float t = float(i + j) * G2;
+    float x0 = x - (float(i) - t);
+    float y0 = y - (float(j) - t);
+
+    int i1 = x0 > y0 ? 1 : 0;
+    int j1 = 1 - i1;
+
+    float x1 = x0 - float(i1) + G2;
+    float y1 = y0 - float(j1) + G2;
+    float x2 = x0 - 1.0 + 2.0 * G2;
+    float y2 = y0 - 1.0 + 2.0 * G2;
+
+    int gi0 = hash(i + hash(j));
+    int gi1 = hash(i + i1 + hash(j + j1));
+    int gi2 = hash(i + 1 + hash(j + 1));
+
+    float n0 = 0.0;
+    float t0 = 0.5 - x0 * x0 - y0 * y0;
+    if (t0 >= 0.0) {
+        t0 *= t0;
+        n0 = t0 * t0 * grad(gi0, x0, y0);
+    }
+
+    float n1 = 0.0;
+    float t1 = 0.5 - x1 * x1 - y1 * y1;
+    if (t1 >= 0.0) {
+        t1 *= t1;
+        n1 = t1 * t1 * grad(gi1, x1, y1);
+    }
+
+    float n2 = 0.0;
+    float t2 = 0.5 - x2 * x2 - y2 * y2;
+    if (t2 >= 0.0) {
+        t2 *= t2;
+        n2 = t2 * t2 * grad(gi2, x2, y2);
+    }
+
+    return 45.23065 * (n0 + n1 + n2);
+}
+
+float simplexFractal(int octaves, float x, float y, float frequency, float amplitude, float lacunarity, float persistence) {
+    float value = 0.0;
+    float denom = 0.0;
+    for (int i = 0; i < octaves; i++) {
+        value += amplitude * simplexNoise(x * frequency, y * frequency);
+        denom += amplitude;
+        frequency *= lacunarity;
+        amplitude *= persistence;
+    }
+    return value / denom;
+}
@@ -2,12 +2,63 @@
 
 #include <vector>
 #include <cmath>
-#include <map>
-#include <glad/glad.h>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <cfloat>
+#include <memory>
+#include <string>
 #include <glm/glm/glm.hpp>
 #include <glm/glm/gtc/matrix_transform.hpp>
 
 #include "SimplexNoise.h"
+#include "frustum.h"
+#include "chunkcache.h"
+#include "trace.h"
+
+enum Terrain_Mesh_Mode {
+    FLAT_SHADED,    // six vertices per grid quad, one face normal per triangle
+    SHARED_VERTEX,  // one vertex per lattice point with averaged normals and a real index buffer
+    TESSELLATED_PATCHES, // no mesh, the heightfield is a heightmap layer and the tessellator builds the surface (GL 4.1)
+    HEIGHTMAP_GRID  // SHARED_VERTEX's lattice shared by every chunk, chunkmap.vert reads heights from a heightmap layer
+};
+
+enum Terrain_Height_Source {
+    CPU_HEIGHTFIELD, // the worker threads sample SimplexNoise
+    GPU_HEIGHTFIELD  // TESSELLATED_PATCHES only, heightmap.glsl fills the renderer's heightmap layer (GL 4.3)
+};
+
+enum Terrain_Vertex_Format {
+    FLOAT_VERTEX,   // 8 floats, position, normal and texture coordinate (32 bytes)
+    PACKED_VERTEX   // packedTerrainVertex (8 bytes), decoded in chunkmap.vert
+};
+
+// Quantized terrain vertex, x/z are implied by the lattice and the texture coordinate is derived from them in the shader
+struct packedTerrainVertex {
+    uint16_t x;         // lattice index inside the chunk along x
+    uint16_t z;         // lattice index inside the chunk along z
+    uint16_t height;    // 0 is -mapHeight, 65535 is +mapHeight
+    int8_t normal[2];   // octahedral encoded normal, snorm8
+};
+
+inline size_t terrainVertexStride(Terrain_Vertex_Format vertexFormat) {
+    return vertexFormat == PACKED_VERTEX ? sizeof(packedTerrainVertex) : 8 * sizeof(float);
+}
+
+// Heap memory of a set of chunks by what holds it
+struct chunkMemoryUse {
+    size_t vertices = 0;
+    size_t indices = 0;
+    size_t heightfields = 0;
+    size_t records = 0; // the terrainChunk structs
+};
 
 struct terrainChunk {
     int posX = 0;
@@ -15,14 +66,289 @@ struct terrainChunk {
     int size = 0; 
     int chunkID = 0;
     std::vector<float> vertices;
+    std::vector<packedTerrainVertex> packedVertices; // used instead of vertices with PACKED_VERTEX
     std::vector<unsigned int> indices;
+    std::vector<float> heightfield; // heightfieldSize^2 heights, the chunk's lattice plus a one sample apron
+                                    // heightfieldSpacing() apart, the heightmap itself with TESSELLATED_PATCHES
+    int heightfieldSize = 0;
+    int verticesPerSide = 0;
     std::pair<int, int> chunkMapCoords;
     bool generated = false;
-    bool visible = false;
-    bool buffered = false;
+    bool buffered = false; // gpuSlot holds this chunk's geometry
     bool hasWater = false;
-    unsigned int numStrips = 0;
-    unsigned int numVertsPerStrip = 0;
+    float minHeight = 0.0f; // height range of the chunk's lattice, the culling box also covers the water plane if it has one
+    float maxHeight = 0.0f;
+    int lodLevel = 0; // picked every frame by checkForVisibleChunks, only read on the render thread
+    unsigned int indexCount = 0;
+    int gpuSlot = -1; // slot in the renderer's geometry pool, stays with a recycled chunk and is refilled by the next upload
+    size_t gpuVertexBytes = 0; // size of the slot's vertex and index ranges, the heightmap layer with TESSELLATED_PATCHES/HEIGHTMAP_GRID
+    size_t gpuIndexBytes = 0;
+
+    // whichever vertex array the chunk was built with
+    const void* vertexData() const {
+        return packedVertices.empty() ? (const void*)vertices.data() : (const void*)packedVertices.data();
+    }
+
+    size_t vertexBytes() const {
+        return vertices.size() * sizeof(float) + packedVertices.size() * sizeof(packedTerrainVertex);
+    }
+
+    // heap memory held by the chunk, capacity rather than size since recycled vectors keep theirs
+    size_t cpuBytes() const {
+        return sizeof(terrainChunk) + vertices.capacity() * sizeof(float) + packedVertices.capacity() * sizeof(packedTerrainVertex)
+            + indices.capacity() * sizeof(unsigned int) + heightfield.capacity() * sizeof(float);
+    }
+
+    // cpuBytes split by category
+    void addCpuBytes(chunkMemoryUse* use) const {
+        use->vertices += vertices.capacity() * sizeof(float) + packedVertices.capacity() * sizeof(packedTerrainVertex);
+        use->indices += indices.capacity() * sizeof(unsigned int);
+        use->heightfields += heightfield.capacity() * sizeof(float);
+        use->records += sizeof(terrainChunk);
+    }
+
+    size_t gpuBytes() const {
+        return gpuVertexBytes + gpuIndexBytes;
+    }
+};
+
+// Per-slot bookkeeping kept apart from the chunk geometry so the per frame scans only walk this small array
+struct chunkSlotState {
+    int x = 0;                  // chunk map coordinates of the chunk in the slot
+    int z = 0;
+    uint32_t generation = 0;    // bumped every time the slot is handed to a new chunk
+    bool occupied = false;
+    bool visible = false;
+};
+
+// Fixed-capacity toroidal grid of chunks, chunk (x, z) lives in slot (x mod capacity, z mod capacity).
+// As long as the visible window is no wider than the capacity two chunks in it never share a slot,
+// so a chunk only gets replaced once the player has moved far enough away from it.
+class ChunkStore {
+public:
+    explicit ChunkStore(int capacity) : capacity(capacity), states(capacity * capacity), chunks(capacity * capacity) {
+    }
+
+    int getCapacity() const {
+        return capacity;
+    }
+
+    int slotIndex(int x, int z) const {
+        return wrap(x) * capacity + wrap(z);
+    }
+
+    // nullptr unless chunk (x, z) is resident
+    terrainChunk* find(int x, int z) {
+        int slot = slotIndex(x, z);
+        const chunkSlotState& state = states[slot];
+        return (state.occupied && state.x == x && state.z == z) ? &chunks[slot] : nullptr;
+    }
+
+    terrainChunk* find(std::pair<int, int> coords) {
+        return find(coords.first, coords.second);
+    }
+
+    const terrainChunk* find(int x, int z) const {
+        int slot = slotIndex(x, z);
+        const chunkSlotState& state = states[slot];
+        return (state.occupied && state.x == x && state.z == z) ? &chunks[slot] : nullptr;
+    }
+
+    // neighbouring chunk dx, dz chunks away, nullptr if it isn't resident
+    terrainChunk* neighbour(const terrainChunk& chunk, int dx, int dz) {
+        return find(chunk.chunkMapCoords.first + dx, chunk.chunkMapCoords.second + dz);
+    }
+
+    chunkSlotState& state(const terrainChunk& chunk) {
+        return states[slotIndex(chunk.chunkMapCoords.first, chunk.chunkMapCoords.second)];
+    }
+
+    // Moves the chunk into its slot. Whatever chunk held the slot before is moved into evicted, returns false if there wasn't one.
+    bool insert(terrainChunk&& chunk, terrainChunk* evicted) {
+        int slot = slotIndex(chunk.chunkMapCoords.first, chunk.chunkMapCoords.second);
+        chunkSlotState& state = states[slot];
+        bool replaced = state.occupied;
+        if (replaced) {
+            *evicted = std::move(chunks[slot]);
+        }
+        else {
+            residentChunks++;
+        }
+
+        chunks[slot] = std::move(chunk);
+        state.x = chunks[slot].chunkMapCoords.first;
+        state.z = chunks[slot].chunkMapCoords.second;
+        state.generation++;
+        state.occupied = true;
+        state.visible = false;
+        return replaced;
+    }
+
+    // Moves chunk (x, z) out of the store into evicted, returns false if it isn't resident
+    bool remove(int x, int z, terrainChunk* evicted) {
+        terrainChunk* chunk = find(x, z);
+        if (chunk == nullptr) {
+            return false;
+        }
+
+        *evicted = std::move(*chunk);
+        states[slotIndex(x, z)].occupied = false;
+        residentChunks--;
+        return true;
+    }
+
+    int size() const {
+        return residentChunks;
+    }
+
+    // Slot access for walking every resident chunk, nullptr for empty slots
+    int slotCount() const {
+        return (int)chunks.size();
+    }
+
+    terrainChunk* at(int slot) {
+        return states[slot].occupied ? &chunks[slot] : nullptr;
+    }
+
+private:
+    int capacity;
+    int residentChunks = 0;
+    std::vector<chunkSlotState> states;
+    std::vector<terrainChunk> chunks;
+
+    int wrap(int value) const {
+        int wrapped = value % capacity;
+        return wrapped < 0 ? wrapped + capacity : wrapped;
+    }
+};
+
+// Builds chunks on worker threads so generation never stalls the render loop.
+// Chunks are queued with request() and handed back through collectFinished() once built.
+class ChunkGenerator {
+public:
+    ChunkGenerator(std::function<void(terrainChunk*)> buildChunk, unsigned int workerCount) : buildChunk(buildChunk) {
+        if (workerCount == 0) {
+            unsigned int hardwareThreads = std::thread::hardware_concurrency();
+            workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1; // leave a core for the render thread
+        }
+        for (unsigned int i = 0; i < workerCount; i++) {
+            workers.emplace_back(&ChunkGenerator::workerLoop, this);
+        }
+    }
+
+    ~ChunkGenerator() {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        jobAvailable.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ChunkGenerator(const ChunkGenerator&) = delete;
+    ChunkGenerator& operator=(const ChunkGenerator&) = delete;
+
+    // Queues a chunk for generation, returns false if it is already queued, being built or waiting to be collected.
+    // chunk is only moved from when it is accepted so a recycled chunk can be handed back to the pool.
+    bool request(terrainChunk&& chunk) {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            if (!inFlight.insert(chunk.chunkMapCoords).second) {
+                return false;
+            }
+            jobs.push_back(std::move(chunk));
+        }
+        jobAvailable.notify_one();
+        return true;
+    }
+
+    // Workers pick the queued chunk closest to the focus first
+    void setFocus(std::pair<int, int> focus) {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        this->focus = focus;
+    }
+
+    // Drops queued chunks that have not been started and fall outside the given chunk range, they are moved into discarded
+    void discardOutside(int startX, int endX, int startZ, int endZ, std::vector<terrainChunk>* discarded) {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        auto inside = [&](const terrainChunk& chunk) {
+            const std::pair<int, int>& coords = chunk.chunkMapCoords;
+            return coords.first >= startX && coords.first <= endX && coords.second >= startZ && coords.second <= endZ;
+        };
+        auto firstOutside = std::partition(jobs.begin(), jobs.end(), inside);
+        for (auto it = firstOutside; it != jobs.end(); ++it) {
+            inFlight.erase(it->chunkMapCoords);
+            discarded->push_back(std::move(*it));
+        }
+        jobs.erase(firstOutside, jobs.end());
+    }
+
+    // Hands over every chunk finished since the last call
+    std::vector<terrainChunk> collectFinished() {
+        std::vector<terrainChunk> collected;
+        std::lock_guard<std::mutex> lock(queueMutex);
+        collected.swap(finished);
+        for (const terrainChunk& chunk : collected) {
+            inFlight.erase(chunk.chunkMapCoords);
+        }
+        return collected;
+    }
+
+    int queuedChunks() {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        return (int)inFlight.size();
+    }
+
+    // Blocks until every requested chunk is built and waiting to be collected
+    void waitUntilIdle() {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        jobFinished.wait(lock, [this] { return jobs.empty() && finished.size() == inFlight.size(); });
+    }
+
+private:
+    std::function<void(terrainChunk*)> buildChunk;
+    std::vector<std::thread> workers;
+    std::mutex queueMutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable jobFinished;
+    std::vector<terrainChunk> jobs;
+    std::vector<terrainChunk> finished;
+    std::set<std::pair<int, int>> inFlight;
+    std::pair<int, int> focus = { 0,0 };
+    bool stopping = false;
+
+    int distanceToFocus(const terrainChunk& chunk) const {
+        return std::abs(chunk.chunkMapCoords.first - focus.first) + std::abs(chunk.chunkMapCoords.second - focus.second);
+    }
+
+    void workerLoop() {
+        Tracer::instance().setThreadName("chunk generation");
+        while (true) {
+            terrainChunk chunk;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping) {
+                    return;
+                }
+                auto next = std::min_element(jobs.begin(), jobs.end(), [this](const terrainChunk& a, const terrainChunk& b) {
+                    return distanceToFocus(a) < distanceToFocus(b);
+                    });
+                chunk = std::move(*next);
+                jobs.erase(next);
+            }
+
+            buildChunk(&chunk);
+
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                finished.push_back(std::move(chunk));
+            }
+            jobFinished.notify_all();
+        }
+    }
 };
 
 class Terrain {
@@ -30,68 +356,93 @@ public:
     int chunksGenerated = 0;
     int chunkSize; // Multiple of 5 seems to work not sure about other multiples
     int chunkMapSize;
-    std::map<std::pair<int, int>, terrainChunk> chunkMap;
+    ChunkStore chunkMap;
     float chunkHeight;
     float lacunarity; 
     float persistance; 
     int octaves;
     int chunkResolution;
+    Terrain_Mesh_Mode meshMode;
+    Terrain_Vertex_Format vertexFormat;
+    Terrain_Height_Source heightSource;
     std::pair<int, int> currentChunk = { 0,0 };
 
-    // constructor, generates the initial area around the player
-    Terrain(float chunkHeight, int chunkResolution, float lacunarity, float persistance, int octaves, int chunkMapSize, int chunkSize) {
-        this->chunkHeight = chunkHeight;
-        this->lacunarity = lacunarity;
-        this->persistance = persistance;
-        this->octaves = octaves;
-        this->chunkResolution = chunkResolution;
-        this->chunkSize = chunkSize;
-        this->chunkMapSize = chunkMapSize;
+    // constructor, starts the worker threads that generate the area around the player
+    // generationThreads of 0 uses one thread per core minus the render thread
+    // GPU_HEIGHTFIELD falls back to CPU_HEIGHTFIELD outside TESSELLATED_PATCHES since the meshes need the heights
+    Terrain(float chunkHeight, int chunkResolution, float lacunarity, float persistance, int octaves, int chunkMapSize, int chunkSize, Terrain_Mesh_Mode meshMode = SHARED_VERTEX, Terrain_Vertex_Format vertexFormat = FLOAT_VERTEX, unsigned int generationThreads = 0, Terrain_Height_Source heightSource = CPU_HEIGHTFIELD) :
+        chunkSize(chunkSize),
+        chunkMapSize(chunkMapSize),
+        chunkMap(chunkMapSize + 1 + CHUNK_STORE_MARGIN),
+        chunkHeight(chunkHeight),
+        lacunarity(lacunarity),
+        persistance(persistance),
+        octaves(octaves),
+        chunkResolution(chunkResolution),
+        meshMode(meshMode),
+        vertexFormat(vertexFormat),
+        heightSource(meshMode == TESSELLATED_PATCHES ? heightSource : CPU_HEIGHTFIELD),
+        waterLevel((chunkHeight * 0.4f) - chunkHeight),
+        generator([this](terrainChunk* chunk) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            generateChunk(chunk, this->chunkHeight, this->chunkResolution, this->lacunarity, this->persistance, this->octaves);
+            generationNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            }, generationThreads) {
+        buildLodLevels(); // no chunk is queued before the constructor returns so the workers never see this half built
     }
 
-    std::vector<std::pair<int, int>> checkForVisibleChunks(int chunkMapSize, float playerPosX, float playerPosZ, const glm::vec3& front) {
+    // Returns the generated chunks in the window whose bounds intersect the frustum.
+    // Chunks that aren't generated yet are queued on the worker threads and left out until they are ready,
+    // culled chunks are still generated so turning around doesn't wait on them.
+    // The returned pointers stay valid until the next call.
+    const std::vector<terrainChunk*>& checkForVisibleChunks(int chunkMapSize, float playerPosX, float playerPosZ, const viewFrustum& frustum) {
+        TRACE_SCOPE("checkForVisibleChunks");
         checkCurrentChunk(&currentChunk, playerPosX, playerPosZ);
 
-        std::vector<std::pair<int, int>> visibleChunks;
-        visibleChunks.reserve(chunkMapSize * chunkMapSize); // Reserve space to avoid multiple allocations
+        int halfMapSize = std::min(chunkMapSize, this->chunkMapSize) / 2; // chunkMap is only sized for the constructor's map size
+        windowStart = { currentChunk.first - halfMapSize, currentChunk.second - halfMapSize };
+        windowEnd = { currentChunk.first + halfMapSize, currentChunk.second + halfMapSize };
+        collectGeneratedChunks();
+        trimToBudget();
 
-        int halfMapSize = chunkMapSize / 2;
-        int startX = currentChunk.first - halfMapSize;
-        int endX = currentChunk.first + halfMapSize;
-        int startZ = currentChunk.second - halfMapSize;
-        int endZ = currentChunk.second + halfMapSize;
+        visibleChunks.clear();
+        culledChunks = 0;
+        drawnTriangles = 0;
+        generator.setFocus(currentChunk);
+        discardedChunks.clear();
+        generator.discardOutside(windowStart.first, windowEnd.first, windowStart.second, windowEnd.second, &discardedChunks);
+        for (terrainChunk& discarded : discardedChunks) {
+            recycleChunk(std::move(discarded));
+        }
 
-        for (int x = startX; x <= endX; ++x) {
-            for (int z = startZ; z <= endZ; ++z) {
-                auto chunkCoords = std::make_pair(x, z);
-                auto it = chunkMap.find(chunkCoords);
+        for (int x = windowStart.first; x <= windowEnd.first; ++x) {
+            for (int z = windowStart.second; z <= windowEnd.second; ++z) {
+                terrainChunk* chunk = chunkMap.find(x, z);
 
-                if (it == chunkMap.end()) {
-                    terrainChunk newChunk;
+                if (chunk == nullptr) {
+                    terrainChunk newChunk = takeSpareChunk();
                     newChunk.posX = x * chunkSize;
                     newChunk.posZ = z * chunkSize;
                     newChunk.size = chunkSize + 1;
-                    newChunk.numStrips = newChunk.size * 3;
-                    newChunk.numVertsPerStrip = newChunk.size * 3;
-                    generateChunk(&newChunk, chunkHeight, chunkResolution, lacunarity, persistance, octaves);
-                    newChunk.generated = true;
-                    newChunk.chunkID = chunksGenerated++;
-                    newChunk.chunkMapCoords = chunkCoords;
-                    chunkMap[chunkCoords] = newChunk;
-                    it = chunkMap.find(chunkCoords);
+                    newChunk.chunkMapCoords = std::make_pair(x, z);
+                    if (!generator.request(std::move(newChunk))) {
+                        spareChunks.push_back(std::move(newChunk)); // already in flight
+                    }
+                    continue;
                 }
 
-                terrainChunk& chunk = it->second;
-                glm::vec3 chunkDir = glm::vec3(chunk.posX, 0, chunk.posZ) - glm::vec3(playerPosX, 0, playerPosZ);
+                glm::vec3 minCorner, maxCorner;
+                chunkBounds(*chunk, &minCorner, &maxCorner);
 
-                if (glm::dot(front, chunkDir) > 0.0f) {
-                    chunk.visible = true;
-                    visibleChunks.push_back(chunkCoords);
+                bool visible = frustum.intersectsBox(minCorner, maxCorner);
+                chunkMap.state(*chunk).visible = visible;
+                if (visible) {
+                    chunk->lodLevel = selectLodLevel(*chunk, playerPosX, playerPosZ);
+                    drawnTriangles += lodIndexCount(*chunk) / 3;
+                    visibleChunks.push_back(chunk);
                 }
                 else {
-                    chunk.visible = false;
-                    // Problems with not rendering unseen chunks so having them rendered for now
-                    visibleChunks.push_back(chunkCoords);
+                    culledChunks++;
                 }
             }
         }
@@ -99,18 +450,561 @@ public:
         return visibleChunks;
     }
 
-    void printChunkInfo(terrainChunk chunk) {
+    // Limits for resident chunk memory, chunks outside the visible window are evicted farthest first once either is passed.
+    // 0 means no limit. The visible window itself is never evicted, overBudget() reports when it alone doesn't fit.
+    void setMemoryBudget(size_t cpuBytes, size_t gpuBytes) {
+        cpuBudget = cpuBytes;
+        gpuBudget = gpuBytes;
+    }
+
+    // Keeps generated heightfields in region files under directory so revisited areas and later runs skip the noise.
+    // Call before the first checkForVisibleChunks. Does nothing with GPU_HEIGHTFIELD, those heights never reach the CPU.
+    void enableDiskCache(const std::string& directory) {
+        if (heightSource == GPU_HEIGHTFIELD) {
+            return;
+        }
+        diskCache.reset(new ChunkRegionCache(directory, generationHash(), heightfieldSize(), analyticNormals() ? 3 : 1));
+    }
+
+    // Switches to another mesh mode, for when the GPU can't run the one the terrain was built with.
+    // Call before the first checkForVisibleChunks and before enableDiskCache, the cache's record layout depends on it.
+    void setMeshMode(Terrain_Mesh_Mode mode) {
+        meshMode = mode;
+        if (meshMode != TESSELLATED_PATCHES) {
+            heightSource = CPU_HEIGHTFIELD;
+        }
+        buildLodLevels();
+    }
+
+    // nullptr unless enableDiskCache was called
+    ChunkRegionCache* getDiskCache() const {
+        return diskCache.get();
+    }
+
+    bool overBudget() const {
+        return (cpuBudget != 0 && residentCpu > cpuBudget) || (gpuBudget != 0 && residentGpu > gpuBudget);
+    }
+
+    // generated chunks in the window the last checkForVisibleChunks call left out
+    int culledChunkCount() const {
+        return culledChunks;
+    }
+
+    // Terrain heights on a regular grid, out[i * countZ + j] is the height at (x0 + i * step, z0 + j * step).
+    // Same noise as the chunks so anything built from it lines up with them. Safe to call from any thread.
+    void sampleHeightGrid(float x0, float z0, float step, int countX, int countZ, float* out) const {
+        SimplexNoise simplex(noiseFrequency(), NOISE_AMPLITUDE, lacunarity, persistance);
+        simplex.fractal2DGrid(octaves, x0, z0, step, countX, countZ, out);
+        for (int i = 0; i < countX * countZ; i++) {
+            out[i] *= chunkHeight;
+        }
+    }
+
+    // Height of the surface the chunks draw at their full level of detail, the same a b c / a c d triangles as the index
+    // lists, read out of a resident chunk's heightfield. Points in chunks that aren't resident (or have no CPU heightfield
+    // with GPU_HEIGHTFIELD) fall back to the noise. Safe to call from any thread.
+    float heightAt(float x, float z) const {
+        std::shared_lock<std::shared_timed_mutex> lock(chunkMapMutex);
+        float height;
+        if (residentHeightAt(x, z, &height)) {
+            return height;
+        }
+        SimplexNoise simplex(noiseFrequency(), NOISE_AMPLITUDE, lacunarity, persistance);
+        return simplex.fractal(octaves, x, z) * chunkHeight;
+    }
+
+    // Smooth surface normal, the central difference gradients at the four surrounding heightfield samples blended
+    // bilinearly. Falls back to the noise's analytic gradient like heightAt. Safe to call from any thread.
+    glm::vec3 normalAt(float x, float z) const {
+        std::shared_lock<std::shared_timed_mutex> lock(chunkMapMutex);
+        glm::vec2 slope;
+        if (!residentSlopeAt(x, z, &slope)) {
+            SimplexNoise simplex(noiseFrequency(), NOISE_AMPLITUDE, lacunarity, persistance);
+            SimplexNoise::Derivatives sample = simplex.fractalWithDerivatives(octaves, x, z);
+            slope = glm::vec2(sample.dx, sample.dy) * chunkHeight;
+        }
+        return glm::normalize(glm::vec3(-slope.x, 1.0f, -slope.y));
+    }
+
+    // heightAt for count points (x, z) under one lock, the points that miss the resident chunks go through the batched noise
+    void heightsAt(const glm::vec2* points, float* heights, size_t count) const {
+        std::vector<size_t> missed;
+        {
+            std::shared_lock<std::shared_timed_mutex> lock(chunkMapMutex);
+            for (size_t k = 0; k < count; k++) {
+                if (!residentHeightAt(points[k].x, points[k].y, &heights[k])) {
+                    missed.push_back(k);
+                }
+            }
+        }
+        if (missed.empty()) {
+            return;
+        }
+
+        std::vector<float> xs(missed.size()), zs(missed.size()), noise(missed.size());
+        for (size_t m = 0; m < missed.size(); m++) {
+            xs[m] = points[missed[m]].x;
+            zs[m] = points[missed[m]].y;
+        }
+        SimplexNoise simplex(noiseFrequency(), NOISE_AMPLITUDE, lacunarity, persistance);
+        simplex.fractal2D(octaves, xs.data(), zs.data(), noise.data(), missed.size());
+        for (size_t m = 0; m < missed.size(); m++) {
+            heights[missed[m]] = noise[m] * chunkHeight;
+        }
+    }
+
+    float getWaterLevel() const {
+        return waterLevel;
+    }
+
+    // First octave of the SimplexNoise every height comes from, for generating the same heights elsewhere (heightmap.glsl)
+    float noiseFrequency() const {
+        return 0.1f / NOISE_SCALE;
+    }
+
+    float noiseAmplitude() const {
+        return NOISE_AMPLITUDE;
+    }
+
+    // triangles in the chunks the last checkForVisibleChunks call returned, at their selected level of detail.
+    // Always 0 with TESSELLATED_PATCHES, the triangles only exist on the GPU.
+    int drawnTriangleCount() const {
+        return drawnTriangles;
+    }
+
+    // Level of detail, CDLOD style. With SHARED_VERTEX and HEIGHTMAP_GRID every level draws a subset of the chunk's full resolution
+    // vertices through an index list shared by every chunk, level l keeps every lodStride(l)th lattice point.
+    // Vertices of a level l chunk morph onto the level l + 1 surface over lodMorphStart(l) to lodMorphEnd(l)
+    // (see chunkmap.vert) so nothing pops when a chunk switches level. FLAT_SHADED only has level 0.
+    int lodLevelCount() const {
+        return (int)lodStrides.size();
+    }
+
+    int lodStride(int level) const {
+        return lodStrides[level];
+    }
+
+    float lodMorphStart(int level) const {
+        return lodMorphRanges[level].x;
+    }
+
+    float lodMorphEnd(int level) const {
+        return lodMorphRanges[level].y;
+    }
+
+    // Shared index lists by level, empty with FLAT_SHADED where every chunk carries its own indices
+    const std::vector<std::vector<unsigned int>>& lodIndexLists() const {
+        return lodIndices;
+    }
+
+    unsigned int lodIndexCount(const terrainChunk& chunk) const {
+        return lodIndices.empty() ? chunk.indexCount : (unsigned int)lodIndices[chunk.lodLevel].size();
+    }
+
+    // World space box around everything drawn for the chunk
+    void chunkBounds(const terrainChunk& chunk, glm::vec3* minCorner, glm::vec3* maxCorner) const {
+        *minCorner = glm::vec3((float)chunk.posX, chunk.minHeight, (float)chunk.posZ);
+        *maxCorner = glm::vec3((float)(chunk.posX + chunkSize), chunk.maxHeight, (float)(chunk.posZ + chunkSize));
+        if (chunk.hasWater) {
+            // the water plane is centred on the chunk's corner, see waterPlaneVertices in application.cpp
+            float halfChunk = chunkSize / 2.0f;
+            minCorner->x -= halfChunk;
+            minCorner->z -= halfChunk;
+            minCorner->y = std::min(minCorner->y, waterLevel);
+            maxCorner->y = std::max(maxCorner->y, waterLevel);
+        }
+    }
+
+    int residentChunks() const {
+        return chunkMap.size();
+    }
+
+    // Totals from the last checkForVisibleChunks call, spare chunks waiting to be reused are included
+    size_t residentCpuBytes() const {
+        return residentCpu;
+    }
+
+    size_t residentGpuBytes() const {
+        return residentGpu;
+    }
+
+    // residentCpuBytes by category, chunks on the generation threads aren't counted until they are collected
+    const chunkMemoryUse& residentCpuUse() const {
+        return residentCpuCategories;
+    }
+
+    // Distance between heightfield samples. Patches sample the heightmap at whatever rate the tessellator picks
+    // so it is kept finer than a mesh vertex, that is the detail close patches get beyond the other modes.
+    float heightfieldSpacing() const {
+        return meshMode == TESSELLATED_PATCHES ? chunkResolution / TESSELLATION_HEIGHTMAP_DETAIL : (float)chunkResolution;
+    }
+
+    // Samples per side of a chunk's heightfield including the apron, the heightmap layer size with TESSELLATED_PATCHES/HEIGHTMAP_GRID
+    int heightfieldSize() const {
+        return (int)std::lround(chunkSize / heightfieldSpacing()) + 3;
+    }
+
+    // Upper bounds the renderer sizes its geometry pool slots and slot count with, 0 where chunks have no vertices
+    int maxChunkVertices() const {
+        if (!chunksHaveVertices()) {
+            return 0;
+        }
+        int quadsPerSide = chunkSize / chunkResolution;
+        return meshMode == SHARED_VERTEX ? (quadsPerSide + 1) * (quadsPerSide + 1) : quadsPerSide * quadsPerSide * 6;
+    }
+
+    int maxChunkIndices() const {
+        if (meshMode != FLAT_SHADED) {
+            return 0; // drawn with lodIndexLists() or as patches
+        }
+        int quadsPerSide = chunkSize / chunkResolution;
+        return quadsPerSide * quadsPerSide * 6;
+    }
+
+    // The GPU budget trims chunkMap down to what fits so the pool doesn't need a slot for every store slot
+    int maxBufferedChunks() const {
+        int storeChunks = chunkMap.getCapacity() * chunkMap.getCapacity();
+        if (gpuBudget != 0) {
+            size_t slotBytes = maxChunkVertices() * terrainVertexStride(vertexFormat) + maxChunkIndices() * sizeof(unsigned int);
+            if (!chunksHaveVertices()) {
+                slotBytes = (size_t)heightfieldSize() * heightfieldSize() * sizeof(float);
+            }
+            int windowSide = (chunkMapSize / 2) * 2 + 1;
+            storeChunks = std::min(storeChunks, std::max(windowSide * windowSide, (int)(gpuBudget / slotBytes)));
+        }
+        return storeChunks + maxSpareChunks();
+    }
+
+    // Chunks the pool had no room for since the last call, the renderer releases their GPU slots
+    std::vector<terrainChunk> takeEvictedChunks() {
+        std::vector<terrainChunk> taken;
+        taken.swap(evictedChunks);
+        return taken;
+    }
+
+    int queuedChunks() {
+        return generator.queuedChunks();
+    }
+
+    // Waits for the generation threads to finish everything requested so far, the next checkForVisibleChunks collects
+    // all of it. Makes which chunks exist on a given frame independent of thread timing, for benchmark runs.
+    void waitForGeneration() {
+        generator.waitUntilIdle();
+    }
+
+    // Builds the chunk at chunk map coordinates (chunkX, chunkZ) on the calling thread, without the generation threads
+    // or the chunk map. For benchmarks and tools, chunk can be reused between calls.
+    void generateChunkAt(terrainChunk* chunk, int chunkX, int chunkZ) {
+        chunk->posX = chunkX * chunkSize;
+        chunk->posZ = chunkZ * chunkSize;
+        chunk->size = chunkSize + 1;
+        chunk->chunkMapCoords = std::make_pair(chunkX, chunkZ);
+        generateChunk(chunk, chunkHeight, chunkResolution, lacunarity, persistance, octaves);
+    }
+
+    // Time the generation threads spent building chunks since the last call, summed over the threads
+    double takeGenerationMilliseconds() {
+        return generationNanoseconds.exchange(0) / 1.0e6;
+    }
+
+    void printChunkInfo(const terrainChunk& chunk) {
         std::cout << "Chunk ID: " << chunk.chunkID << std::endl;
         std::cout << "Chunk Coordinates: X " << chunk.posX << " Z " << chunk.posZ << std::endl;
-        std::cout << "Generated: " << chunk.generated << " Visible: " << chunk.visible << std::endl;
+        std::cout << "Generated: " << chunk.generated << " Visible: " << chunkMap.state(chunk).visible << std::endl;
     }
 
 private:
     const unsigned int TEXTURE_SIZE = 10;
-    const float waterLevel = (chunkHeight * 0.4f) - chunkHeight; // If chunkmap.frag's water level is changed from 0.2f adjust this value
+    static const int CHUNK_STORE_MARGIN = 6; // rows kept around the window so turning back doesn't regenerate, trimmed by the memory budget
+    const float NOISE_SCALE = 50.0f;
+    const float NOISE_AMPLITUDE = 0.5f;
+    const float TESSELLATION_HEIGHTMAP_DETAIL = 2.0f; // heightmap samples per mesh vertex spacing with TESSELLATED_PATCHES
+    static const int GPU_BOUNDS_SAMPLES = 9;          // per side, for the GPU_HEIGHTFIELD chunk bounds
+    const float SIMPLEX_MAX_GRADIENT = 8.0f;          // SimplexNoise::noise's steepest slope is about 7.4
+    std::vector<terrainChunk*> visibleChunks;
+    int culledChunks = 0;
+    int drawnTriangles = 0;
+    const float LOD_BASE_RANGE = 2.0f;    // level 0 reaches this many chunk sizes from the camera
+    const float LOD_MORPH_RATIO = 0.7f;   // fraction of a level's range before its morph starts
+    std::vector<int> lodStrides;
+    std::vector<glm::vec2> lodMorphRanges;
+    std::vector<std::vector<unsigned int>> lodIndices;
+    std::vector<terrainChunk> evictedChunks;
+    std::vector<terrainChunk> spareChunks; // evicted chunks whose vectors and GL objects are reused for new chunks
+    std::vector<terrainChunk> discardedChunks;
+    std::vector<std::pair<int, terrainChunk*>> evictionCandidates;
+    size_t cpuBudget = 0;
+    size_t gpuBudget = 0;
+    size_t residentCpu = 0;
+    size_t residentGpu = 0;
+    chunkMemoryUse residentCpuCategories;
+    std::pair<int, int> windowStart = { 0,0 };
+    std::pair<int, int> windowEnd = { 0,0 };
+    const float waterLevel; // (chunkHeight * 0.4f) - chunkHeight, if chunkmap.frag's water level is changed from 0.2f adjust this value
+    std::unique_ptr<ChunkRegionCache> diskCache;
+    std::atomic<long long> generationNanoseconds{ 0 };
+    mutable std::shared_timed_mutex chunkMapMutex; // held exclusively while the render thread moves chunks in or out of chunkMap, shared by the height queries
+    ChunkGenerator generator; // declared last so the workers are joined before anything they read is destroyed
+
+    // Moves chunks the workers have finished into chunkMap, only called from the render thread.
+    // Chunks that finished after the player already left their area are recycled straight away.
+    void collectGeneratedChunks() {
+        std::lock_guard<std::shared_timed_mutex> lock(chunkMapMutex);
+        for (terrainChunk& chunk : generator.collectFinished()) {
+            if (!insideWindow(chunk.chunkMapCoords.first, chunk.chunkMapCoords.second)) {
+                recycleChunk(std::move(chunk));
+                continue;
+            }
+
+            chunk.chunkID = chunksGenerated++;
+            terrainChunk evicted;
+            if (chunkMap.insert(std::move(chunk), &evicted)) {
+                recycleChunk(std::move(evicted));
+            }
+        }
+    }
+
+    bool insideWindow(int x, int z) const {
+        return x >= windowStart.first && x <= windowEnd.first && z >= windowStart.second && z <= windowEnd.second;
+    }
+
+    // Recomputes the memory totals and evicts chunks outside the window, farthest from currentChunk first, until they fit the budget
+    void trimToBudget() {
+        residentCpu = 0;
+        residentGpu = 0;
+        residentCpuCategories = chunkMemoryUse();
+        evictionCandidates.clear();
+        for (int slot = 0; slot < chunkMap.slotCount(); slot++) {
+            terrainChunk* chunk = chunkMap.at(slot);
+            if (chunk == nullptr) {
+                continue;
+            }
+            residentCpu += chunk->cpuBytes();
+            residentGpu += chunk->gpuBytes();
+            chunk->addCpuBytes(&residentCpuCategories);
+
+            int x = chunk->chunkMapCoords.first;
+            int z = chunk->chunkMapCoords.second;
+            if (!insideWindow(x, z)) {
+                int distance = std::max(std::abs(x - currentChunk.first), std::abs(z - currentChunk.second));
+                evictionCandidates.push_back(std::make_pair(distance, chunk));
+            }
+        }
+        for (const terrainChunk& spare : spareChunks) {
+            residentCpu += spare.cpuBytes();
+            residentGpu += spare.gpuBytes();
+            spare.addCpuBytes(&residentCpuCategories);
+        }
+
+        if (!overBudget()) {
+            return;
+        }
+
+        std::sort(evictionCandidates.begin(), evictionCandidates.end(), [](const std::pair<int, terrainChunk*>& a, const std::pair<int, terrainChunk*>& b) {
+            return a.first > b.first;
+            });
+        for (const std::pair<int, terrainChunk*>& candidate : evictionCandidates) {
+            if (!overBudget()) {
+                break;
+            }
+            // spare chunks are counted already, an evicted chunk only stops counting if the pool is full and it's released
+            terrainChunk evicted;
+            {
+                std::lock_guard<std::shared_timed_mutex> lock(chunkMapMutex);
+                chunkMap.remove(candidate.second->chunkMapCoords.first, candidate.second->chunkMapCoords.second, &evicted);
+            }
+            size_t cpuBytes = evicted.cpuBytes();
+            size_t gpuBytes = evicted.gpuBytes();
+            chunkMemoryUse released;
+            evicted.addCpuBytes(&released);
+            if (recycleChunk(std::move(evicted))) {
+                continue;
+            }
+            residentCpu -= cpuBytes;
+            residentGpu -= gpuBytes;
+            residentCpuCategories.vertices -= released.vertices;
+            residentCpuCategories.indices -= released.indices;
+            residentCpuCategories.heightfields -= released.heightfields;
+            residentCpuCategories.records -= released.records;
+        }
+    }
+
+    // Clears a chunk that left chunkMap and keeps it for reuse, returns false if the pool is full and the chunk was released instead
+    bool recycleChunk(terrainChunk&& chunk) {
+        if ((int)spareChunks.size() >= maxSpareChunks()) {
+            evictedChunks.push_back(std::move(chunk));
+            return false;
+        }
+
+        chunk.vertices.clear();
+        chunk.packedVertices.clear();
+        chunk.indices.clear();
+        chunk.heightfield.clear();
+        chunk.generated = false;
+        chunk.buffered = false;
+        chunk.hasWater = false;
+        chunk.indexCount = 0;
+        spareChunks.push_back(std::move(chunk));
+        return true;
+    }
+
+    // std::floor is a library call without SSE4.1, the queries are meant to be cheap enough to run thousands a frame
+    static int floorToInt(float value) {
+        int truncated = (int)value;
+        return value < truncated ? truncated - 1 : truncated;
+    }
+
+    // Resident chunk containing world point (x, z) and the point's position in its heightfield lattice, nullptr if there
+    // isn't one with heights on the CPU. Callers hold chunkMapMutex.
+    const terrainChunk* residentLatticePoint(float x, float z, int* i, int* j, float* du, float* dv) const {
+        int chunkX = floorToInt(x / chunkSize);
+        int chunkZ = floorToInt(z / chunkSize);
+        const terrainChunk* chunk = chunkMap.find(chunkX, chunkZ);
+        if (chunk == nullptr || chunk->heightfield.empty()) {
+            return nullptr;
+        }
+
+        float spacing = heightfieldSpacing();
+        float u = (x - chunk->posX) / spacing;
+        float v = (z - chunk->posZ) / spacing;
+        *i = std::min(std::max(floorToInt(u), 0), chunk->verticesPerSide - 2);
+        *j = std::min(std::max(floorToInt(v), 0), chunk->verticesPerSide - 2);
+        *du = u - *i;
+        *dv = v - *j;
+        return chunk;
+    }
+
+    bool residentHeightAt(float x, float z, float* height) const {
+        int i, j;
+        float du, dv;
+        const terrainChunk* chunk = residentLatticePoint(x, z, &i, &j, &du, &dv);
+        if (chunk == nullptr) {
+            return false;
+        }
+
+        float a = heightfieldAt(chunk, i, j);
+        float b = heightfieldAt(chunk, i, j + 1);
+        float c = heightfieldAt(chunk, i + 1, j + 1);
+        float d = heightfieldAt(chunk, i + 1, j);
+        *height = dv >= du ? a + dv * (b - a) + du * (c - b) : a + du * (d - a) + dv * (c - d);
+        return true;
+    }
+
+    // dh/dx and dh/dz
+    bool residentSlopeAt(float x, float z, glm::vec2* slope) const {
+        int i, j;
+        float du, dv;
+        const terrainChunk* chunk = residentLatticePoint(x, z, &i, &j, &du, &dv);
+        if (chunk == nullptr) {
+            return false;
+        }
+
+        // the apron covers i - 1 and i + 2 at the chunk's borders
+        float spacing = heightfieldSpacing();
+        auto slopeAt = [&](int si, int sj) {
+            return glm::vec2(heightfieldAt(chunk, si + 1, sj) - heightfieldAt(chunk, si - 1, sj),
+                heightfieldAt(chunk, si, sj + 1) - heightfieldAt(chunk, si, sj - 1)) / (2.0f * spacing);
+        };
+        glm::vec2 lowerRow = glm::mix(slopeAt(i, j), slopeAt(i, j + 1), dv);
+        glm::vec2 upperRow = glm::mix(slopeAt(i + 1, j), slopeAt(i + 1, j + 1), dv);
+        *slope = glm::mix(lowerRow, upperRow, du);
+        return true;
+    }
+
+    // every chunk is the same lattice of verticesPerSide^2 points drawn through lodIndexLists()
+    bool sharedLattice() const {
+        return meshMode == SHARED_VERTEX || meshMode == HEIGHTMAP_GRID;
+    }
+
+    bool chunksHaveVertices() const {
+        return meshMode == SHARED_VERTEX || meshMode == FLAT_SHADED;
+    }
+
+    int maxSpareChunks() const {
+        return 2 * (chunkMapSize + 1); // a couple of rows of new chunks as the player crosses borders
+    }
+
+    terrainChunk takeSpareChunk() {
+        if (spareChunks.empty()) {
+            return terrainChunk();
+        }
+        terrainChunk spare = std::move(spareChunks.back());
+        spareChunks.pop_back();
+        return spare;
+    }
+
+    // Strides are chained divisors of the quads per side (50 gives 1, 2, 10, 50) so every coarse lattice point is also a
+    // fine one and chunk borders line up at every level. Ranges leave a chunk diagonal between one level's morph end and
+    // the next level's morph start, that keeps neighbouring chunks within one level of each other and a chunk's border
+    // vertices fully morphed wherever it meets a coarser chunk.
+    void buildLodLevels() {
+        int quadsPerSide = chunkSize / chunkResolution;
+        lodStrides.assign(1, 1);
+        lodMorphRanges.clear();
+        lodIndices.clear();
+        if (sharedLattice()) {
+            int remaining = quadsPerSide;
+            for (int factor = 2; factor <= remaining; ) {
+                if (remaining % factor == 0) {
+                    lodStrides.push_back(lodStrides.back() * factor);
+                    remaining /= factor;
+                }
+                else {
+                    factor++;
+                }
+            }
+        }
+
+        float chunkDiagonal = chunkSize * std::sqrt(2.0f);
+        float range = LOD_BASE_RANGE * chunkSize;
+        lodMorphRanges.push_back(glm::vec2(range * LOD_MORPH_RATIO, range));
+        for (size_t level = 1; level < lodStrides.size(); level++) {
+            float morphStart = lodMorphRanges.back().y + chunkDiagonal;
+            lodMorphRanges.push_back(glm::vec2(morphStart, morphStart / LOD_MORPH_RATIO));
+        }
+        lodMorphRanges.back() = glm::vec2(FLT_MAX, FLT_MAX); // nothing coarser to morph to
+
+        if (!sharedLattice()) {
+            return;
+        }
+
+        // same a b c / a c d split at every level so each fine triangle lies inside one coarse triangle
+        int verticesPerSide = quadsPerSide + 1;
+        auto vertexAt = [verticesPerSide](int i, int j) { return (unsigned int)(i * verticesPerSide + j); };
+        for (int stride : lodStrides) {
+            std::vector<unsigned int> indices;
+            indices.reserve((quadsPerSide / stride) * (quadsPerSide / stride) * 6);
+            for (int i = 0; i < quadsPerSide; i += stride) {
+                for (int j = 0; j < quadsPerSide; j += stride) {
+                    unsigned int a = vertexAt(i, j), b = vertexAt(i, j + stride), c = vertexAt(i + stride, j + stride), d = vertexAt(i + stride, j);
+                    indices.push_back(a);
+                    indices.push_back(b);
+                    indices.push_back(c);
+                    indices.push_back(a);
+                    indices.push_back(c);
+                    indices.push_back(d);
+                }
+            }
+            lodIndices.push_back(std::move(indices));
+        }
+    }
+
+    // First level whose range reaches the chunk's lattice, measured on the xz plane like the morph in chunkmap.vert.
+    // Uses the lattice rather than chunkBounds since the water plane would pull the chunk closer than its vertices are.
+    int selectLodLevel(const terrainChunk& chunk, float cameraX, float cameraZ) const {
+        float dx = std::max(std::max(chunk.posX - cameraX, cameraX - (chunk.posX + chunkSize)), 0.0f);
+        float dz = std::max(std::max(chunk.posZ - cameraZ, cameraZ - (chunk.posZ + chunkSize)), 0.0f);
+        float distance = std::sqrt(dx * dx + dz * dz);
+
+        int level = 0;
+        while (level + 1 < lodLevelCount() && distance >= lodMorphRanges[level].y) {
+            level++;
+        }
+        return level;
+    }
 
     void checkCurrentChunk(std::pair<int, int>* currentChunk, float playerPosX, float playerPosZ) {
-        int adjustedPositionX = std::abs(playerPosX) / chunkSize; // truncates float, gives x and z values for chunkMap map
+        int adjustedPositionX = std::abs(playerPosX) / chunkSize; // truncates float, gives x and z values for chunkMap
         int adjustedPositionZ = std::abs(playerPosZ) / chunkSize;
 
         if (playerPosX < 0) {
@@ -136,49 +1030,247 @@ private:
     }
 
     void generateChunk(terrainChunk* chunk, float mapHeight, int chunkResolution, float lacunarity, float persistance, int octaves) {
-        int vertexIndex = 0;
-        float scale = 50.0f;
+        TRACE_SCOPE("generateChunk");
+        // the chunk may be a reused one, everything the stages below only ever set starts over
+        chunk->generated = false;
+        chunk->hasWater = false;
+        chunk->indexCount = 0;
         chunk->vertices.clear();
+        chunk->packedVertices.clear();
         chunk->indices.clear();
 
-        SimplexNoise simplex(0.1f / scale, 0.5f, lacunarity, persistance);
-        chunk->vertices.reserve((chunk->size - 1) * (chunk->size - 1) * 6 * 8); // Reserve space for vertices
-        chunk->indices.reserve((chunk->size - 1) * (chunk->size - 1) * 6); // Reserve space for indices
+        if (heightSource == GPU_HEIGHTFIELD) {
+            reserveGpuHeightfield(chunk, mapHeight);
+            return;
+        }
+
+        std::vector<float>* slopes = analyticNormals() ? &slopeScratch() : nullptr;
+        if (!loadCachedHeightfield(chunk, slopes)) {
+            SimplexNoise simplex(noiseFrequency(), NOISE_AMPLITUDE, lacunarity, persistance);
+            generateHeightfield(chunk, simplex, mapHeight, heightfieldSpacing(), octaves, slopes);
+            storeCachedHeightfield(chunk, slopes);
+        }
+
+        if (meshMode == TESSELLATED_PATCHES) {
+            chunk->indexCount = 0; // the heightfield is all the renderer needs
+        }
+        else if (meshMode == HEIGHTMAP_GRID) {
+            chunk->indexCount = (unsigned int)lodIndices[0].size(); // so is it here, the lattice is the renderer's
+        }
+        else if (meshMode == SHARED_VERTEX) {
+            generateSharedVertexMesh(chunk, chunkResolution, *slopes);
+            chunk->indexCount = (unsigned int)lodIndices[0].size();
+        }
+        else {
+            generateFlatShadedMesh(chunk, chunkResolution);
+            chunk->indexCount = (unsigned int)chunk->indices.size();
+        }
+        chunk->generated = true;
+    }
+
+    // Stage one, samples every lattice point of the chunk plus a one sample apron around it exactly once.
+    // The apron overlaps the neighbouring chunks so normals the shaders take from it match on both sides of a border.
+    // slopes, if given, gets the dh/dx plane followed by the dh/dz plane from the same noise pass.
+    void generateHeightfield(terrainChunk* chunk, const SimplexNoise& simplex, float mapHeight, float spacing, int octaves, std::vector<float>* slopes) {
+        sizeHeightfield(chunk, spacing);
+        size_t samples = chunk->heightfield.size();
+
+        // the whole apron-padded grid goes through the batched (SIMD) noise path in one call
+        if (slopes != nullptr) {
+            slopes->resize(2 * samples);
+            simplex.fractal2DGridWithDerivatives(octaves, chunk->posX - spacing, chunk->posZ - spacing, spacing,
+                chunk->heightfieldSize, chunk->heightfieldSize, chunk->heightfield.data(), slopes->data(), slopes->data() + samples);
+            for (float& slope : *slopes) {
+                slope *= mapHeight;
+            }
+        }
+        else {
+            simplex.fractal2DGrid(octaves, chunk->posX - spacing, chunk->posZ - spacing, spacing,
+                chunk->heightfieldSize, chunk->heightfieldSize, chunk->heightfield.data());
+        }
+
+        chunk->minHeight = mapHeight;
+        chunk->maxHeight = -mapHeight;
+        for (int i = -1; i <= chunk->verticesPerSide; i++) {
+            for (int j = -1; j <= chunk->verticesPerSide; j++) {
+                float& y = chunk->heightfield[(i + 1) * chunk->heightfieldSize + (j + 1)];
+                y *= mapHeight;
+
+                bool insideChunk = i >= 0 && j >= 0 && i < chunk->verticesPerSide && j < chunk->verticesPerSide;
+                if (!insideChunk) {
+                    continue;
+                }
+                chunk->minHeight = std::min(chunk->minHeight, y);
+                chunk->maxHeight = std::max(chunk->maxHeight, y);
+                if (y < waterLevel) {
+                    chunk->hasWater = true;
+                }
+            }
+        }
+    }
+
+    // Lattice and apron dimensions for the spacing, GPU_HEIGHTFIELD chunks only get the dimensions and no CPU heights
+    void sizeHeightfield(terrainChunk* chunk, float spacing) {
+        chunk->verticesPerSide = (int)std::lround((chunk->size - 1) / spacing) + 1;
+        chunk->heightfieldSize = chunk->verticesPerSide + 2;
+        if (heightSource == GPU_HEIGHTFIELD) {
+            chunk->heightfield.clear();
+            return;
+        }
+        chunk->heightfield.resize(chunk->heightfieldSize * chunk->heightfieldSize);
+    }
+
+    // Stage one from the disk cache instead of the noise, false on a miss or without a cache
+    bool loadCachedHeightfield(terrainChunk* chunk, std::vector<float>* slopes) {
+        if (diskCache == nullptr) {
+            return false;
+        }
+        sizeHeightfield(chunk, heightfieldSpacing());
+        if (slopes != nullptr) {
+            slopes->resize(2 * chunk->heightfield.size());
+        }
+        cachedChunkInfo info;
+        if (!diskCache->load(chunk->chunkMapCoords.first, chunk->chunkMapCoords.second, chunk->heightfield.data(),
+            slopes != nullptr ? slopes->data() : nullptr, &info)) {
+            return false;
+        }
+        chunk->minHeight = info.minHeight;
+        chunk->maxHeight = info.maxHeight;
+        chunk->hasWater = info.hasWater;
+        return true;
+    }
+
+    void storeCachedHeightfield(const terrainChunk* chunk, const std::vector<float>* slopes) {
+        if (diskCache == nullptr) {
+            return;
+        }
+        cachedChunkInfo info;
+        info.minHeight = chunk->minHeight;
+        info.maxHeight = chunk->maxHeight;
+        info.hasWater = chunk->hasWater;
+        diskCache->store(chunk->chunkMapCoords.first, chunk->chunkMapCoords.second, chunk->heightfield.data(),
+            slopes != nullptr ? slopes->data() : nullptr, info);
+    }
+
+    // SHARED_VERTEX normals come straight from the noise gradient, the other modes don't need it:
+    // FLAT_SHADED keeps its face normals and the shaders difference the apron for the heightmap modes
+    bool analyticNormals() const {
+        return meshMode == SHARED_VERTEX;
+    }
 
-        for (float x = chunk->posX; x < chunk->size + chunk->posX - 1; x += chunkResolution) {
-            for (float z = chunk->posZ; z < chunk->size + chunk->posZ; z += chunkResolution) {
-                float x1 = x, z1 = z, y1 = simplex.fractal(octaves, x1, z1) * mapHeight;
-                float x2 = x, z2 = z + chunkResolution, y2 = simplex.fractal(octaves, x2, z2) * mapHeight;
-                float x3 = x + chunkResolution, z3 = z + chunkResolution, y3 = simplex.fractal(octaves, x3, z3) * mapHeight;
-                float x4 = x + chunkResolution, z4 = z, y4 = simplex.fractal(octaves, x4, z4) * mapHeight;
+    // Per generation thread, the slopes are only needed until the chunk's mesh is built
+    static std::vector<float>& slopeScratch() {
+        static thread_local std::vector<float> slopes;
+        return slopes;
+    }
+
+    // Everything the heightfields depend on, a disk cache written with a different hash is stale
+    uint64_t generationHash() const {
+        float spacing = heightfieldSpacing();
+        float frequency = noiseFrequency();
+        uint64_t hash = ChunkRegionCache::hashBytes(&chunkHeight, sizeof(chunkHeight));
+        hash = ChunkRegionCache::hashBytes(&lacunarity, sizeof(lacunarity), hash);
+        hash = ChunkRegionCache::hashBytes(&persistance, sizeof(persistance), hash);
+        hash = ChunkRegionCache::hashBytes(&octaves, sizeof(octaves), hash);
+        hash = ChunkRegionCache::hashBytes(&chunkSize, sizeof(chunkSize), hash);
+        hash = ChunkRegionCache::hashBytes(&chunkResolution, sizeof(chunkResolution), hash);
+        hash = ChunkRegionCache::hashBytes(&spacing, sizeof(spacing), hash);
+        hash = ChunkRegionCache::hashBytes(&frequency, sizeof(frequency), hash);
+        return ChunkRegionCache::hashBytes(&NOISE_AMPLITUDE, sizeof(NOISE_AMPLITUDE), hash);
+    }
+
+    // GPU_HEIGHTFIELD, the heights only ever exist in the renderer's heightmap so the chunk is ready straight away.
+    // The bounds and water come from a GPU_BOUNDS_SAMPLES^2 grid of the same noise widened by noiseVariationWithin
+    // the furthest any lattice point is from a sample, so they hold for every height heightmap.glsl can produce.
+    void reserveGpuHeightfield(terrainChunk* chunk, float mapHeight) {
+        float spacing = heightfieldSpacing();
+        sizeHeightfield(chunk, spacing);
+
+        float extent = (chunk->verticesPerSide - 1) * spacing;
+        float step = extent / (GPU_BOUNDS_SAMPLES - 1);
+        float samples[GPU_BOUNDS_SAMPLES * GPU_BOUNDS_SAMPLES];
+        sampleHeightGrid((float)chunk->posX, (float)chunk->posZ, step, GPU_BOUNDS_SAMPLES, GPU_BOUNDS_SAMPLES, samples);
+        float lowest = samples[0];
+        float highest = samples[0];
+        for (float height : samples) {
+            lowest = std::min(lowest, height);
+            highest = std::max(highest, height);
+        }
+
+        float margin = noiseVariationWithin(step * 0.70710678f);
+        chunk->minHeight = std::max(lowest - margin, -mapHeight);
+        chunk->maxHeight = std::min(highest + margin, mapHeight);
+        chunk->hasWater = chunk->minHeight < waterLevel;
+        chunk->indexCount = 0;
+        chunk->generated = true;
+    }
+
+    // Most the heights can change within distance of a point, each octave moves at most its frequency times the simplex
+    // noise's steepest gradient per unit and never more than its full -1 to 1 range
+    float noiseVariationWithin(float distance) const {
+        float variation = 0.0f;
+        float total = 0.0f;
+        float frequency = noiseFrequency();
+        float amplitude = NOISE_AMPLITUDE;
+        for (int i = 0; i < octaves; i++) {
+            variation += amplitude * std::min(2.0f, SIMPLEX_MAX_GRADIENT * frequency * distance);
+            total += amplitude;
+            frequency *= lacunarity;
+            amplitude *= persistance;
+        }
+        return variation / total * chunkHeight;
+    }
+
+    // height of lattice point (i, j) of the chunk, -1 and verticesPerSide reach into the apron
+    float heightfieldAt(const terrainChunk* chunk, int i, int j) const {
+        return chunk->heightfield[(i + 1) * chunk->heightfieldSize + (j + 1)];
+    }
+
+    // Stage two, one vertex per lattice point with its normal from the analytic height gradient stage one left in slopes,
+    // no neighbouring samples involved. Indices are the same for every chunk and come from lodIndexLists().
+    void generateSharedVertexMesh(terrainChunk* chunk, int chunkResolution, const std::vector<float>& slopes) {
+        int verticesPerSide = chunk->verticesPerSide;
+        size_t samples = chunk->heightfield.size();
+        reserveVertices(chunk, verticesPerSide * verticesPerSide);
+
+        for (int i = 0; i < verticesPerSide; i++) {
+            for (int j = 0; j < verticesPerSide; j++) {
+                size_t sample = (i + 1) * chunk->heightfieldSize + (j + 1);
+                glm::vec3 normal = glm::normalize(glm::vec3(-slopes[sample], 1.0f, -slopes[samples + sample]));
+                pushVertex(chunk, i, j, chunkResolution, heightfieldAt(chunk, i, j), normal);
+            }
+        }
+    }
+
+    // Stage two, six vertices per quad so every triangle keeps its own face normal
+    void generateFlatShadedMesh(terrainChunk* chunk, int chunkResolution) {
+        unsigned int vertexIndex = 0;
+        int quadsPerSide = chunk->verticesPerSide - 1;
+        reserveVertices(chunk, quadsPerSide * quadsPerSide * 6);
+        chunk->indices.reserve(quadsPerSide * quadsPerSide * 6); // Reserve space for indices
+
+        for (int i = 0; i < quadsPerSide; i++) {
+            for (int j = 0; j < quadsPerSide; j++) {
+                float x = (float)(chunk->posX + i * chunkResolution);
+                float z = (float)(chunk->posZ + j * chunkResolution);
+                float x1 = x, z1 = z, y1 = heightfieldAt(chunk, i, j);
+                float x2 = x, z2 = z + chunkResolution, y2 = heightfieldAt(chunk, i, j + 1);
+                float x3 = x + chunkResolution, z3 = z + chunkResolution, y3 = heightfieldAt(chunk, i + 1, j + 1);
+                float x4 = x + chunkResolution, z4 = z, y4 = heightfieldAt(chunk, i + 1, j);
 
                 glm::vec3 a(x1, y1, z1), b(x2, y2, z2), c(x3, y3, z3), d(x4, y4, z4);
                 glm::vec3 normal1 = calculateTriangleNormal(a, b, c);
                 glm::vec3 normal2 = calculateTriangleNormal(a, c, d);
 
-                float texCoordX1 = x / TEXTURE_SIZE, texCoordZ1 = z / TEXTURE_SIZE;
-                float texCoordX2 = (x + chunkResolution) / TEXTURE_SIZE, texCoordZ2 = (z + chunkResolution) / TEXTURE_SIZE;
-
-                auto pushVertex = [&](float x, float y, float z, const glm::vec3& normal, float texX, float texZ) {
-                    chunk->vertices.push_back(x);
-                    chunk->vertices.push_back(y);
-                    chunk->vertices.push_back(z);
-                    chunk->vertices.push_back(normal.x);
-                    chunk->vertices.push_back(normal.y);
-                    chunk->vertices.push_back(normal.z);
-                    chunk->vertices.push_back(texX);
-                    chunk->vertices.push_back(texZ);
-                    };
-
                 // Triangle 1
-                pushVertex(x1, y1, z1, normal1, texCoordX1, texCoordZ1);
-                pushVertex(x2, y2, z2, normal1, texCoordX1, texCoordZ2);
-                pushVertex(x3, y3, z3, normal1, texCoordX2, texCoordZ2);
+                pushVertex(chunk, i, j, chunkResolution, y1, normal1);
+                pushVertex(chunk, i, j + 1, chunkResolution, y2, normal1);
+                pushVertex(chunk, i + 1, j + 1, chunkResolution, y3, normal1);
 
                 // Triangle 2
-                pushVertex(x1, y1, z1, normal2, texCoordX1, texCoordZ1);
-                pushVertex(x3, y3, z3, normal2, texCoordX2, texCoordZ2);
-                pushVertex(x4, y4, z4, normal2, texCoordX2, texCoordZ1);
+                pushVertex(chunk, i, j, chunkResolution, y1, normal2);
+                pushVertex(chunk, i + 1, j + 1, chunkResolution, y3, normal2);
+                pushVertex(chunk, i + 1, j, chunkResolution, y4, normal2);
 
                 // Indices
                 chunk->indices.push_back(vertexIndex);
@@ -189,13 +1281,55 @@ private:
                 chunk->indices.push_back(vertexIndex + 5);
 
                 vertexIndex += 6;
-
-                if (y1 < waterLevel || y2 < waterLevel || y3 < waterLevel || y4 < waterLevel) {
-					chunk->hasWater = true;
-				}
             }
         }
-        chunk->generated = true;
+    }
+
+    void reserveVertices(terrainChunk* chunk, int vertexCount) {
+        if (vertexFormat == PACKED_VERTEX) {
+            chunk->packedVertices.reserve(vertexCount);
+        }
+        else {
+            chunk->vertices.reserve(vertexCount * 8);
+        }
+    }
+
+    // Writes the vertex for lattice point (i, j) in the chunk's vertex format
+    void pushVertex(terrainChunk* chunk, int i, int j, int chunkResolution, float height, const glm::vec3& normal) {
+        if (vertexFormat == PACKED_VERTEX) {
+            packedTerrainVertex vertex;
+            vertex.x = (uint16_t)i;
+            vertex.z = (uint16_t)j;
+            float normalizedHeight = glm::clamp((height + chunkHeight) / (2.0f * chunkHeight), 0.0f, 1.0f);
+            vertex.height = (uint16_t)std::lround(normalizedHeight * 65535.0f);
+            glm::vec2 octahedral = octahedralEncode(normal);
+            vertex.normal[0] = (int8_t)std::lround(glm::clamp(octahedral.x, -1.0f, 1.0f) * 127.0f);
+            vertex.normal[1] = (int8_t)std::lround(glm::clamp(octahedral.y, -1.0f, 1.0f) * 127.0f);
+            chunk->packedVertices.push_back(vertex);
+            return;
+        }
+
+        float x = (float)(chunk->posX + i * chunkResolution);
+        float z = (float)(chunk->posZ + j * chunkResolution);
+        chunk->vertices.push_back(x);
+        chunk->vertices.push_back(height);
+        chunk->vertices.push_back(z);
+        chunk->vertices.push_back(normal.x);
+        chunk->vertices.push_back(normal.y);
+        chunk->vertices.push_back(normal.z);
+        chunk->vertices.push_back(x / TEXTURE_SIZE);
+        chunk->vertices.push_back(z / TEXTURE_SIZE);
+    }
+
+    // Octahedral normal encoding with y as the up axis, decoded by octahedralDecode in chunkmap.vert
+    static glm::vec2 octahedralEncode(glm::vec3 normal) {
+        normal /= (std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z));
+        glm::vec2 encoded(normal.x, normal.z);
+        if (normal.y < 0.0f) {
+            glm::vec2 signs(encoded.x >= 0.0f ? 1.0f : -1.0f, encoded.y >= 0.0f ? 1.0f : -1.0f);
+            encoded = (1.0f - glm::abs(glm::vec2(encoded.y, encoded.x))) * signs;
+        }
+        return encoded;
     }
 
     void generateWaterPlane(terrainChunk* chunk, float mapHeight) {
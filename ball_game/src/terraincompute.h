@@ -0,0 +1,141 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+#include <glad/glad.h>
+
+#include "terrain.h"
+#include "shader.h"
+#include "memorystats.h"
+
+// GPU_HEIGHTFIELD generation. heightmap.glsl samples the same fBm as SimplexNoise::fractal straight into a layer of the
+// renderer's heightmap array and normalmap.glsl runs a Sobel filter over it into the matching normal map layer, so a
+// chunk costs two dispatches on the render thread and nothing on the workers.
+// The parity check reads every generated layer back and compares it with Terrain::sampleHeightGrid, it stalls the
+// pipeline on each chunk and is only meant for testing the shaders.
+class HeightmapCompute {
+public:
+    HeightmapCompute(const Terrain& terrain, const char* heightmapPath, const char* normalmapPath) :
+        terrain(terrain),
+        heightmapShader(heightmapPath),
+        normalmapShader(normalmapPath),
+        size(terrain.heightfieldSize()),
+        spacing(terrain.heightfieldSpacing()) {
+        heightmapShader.use();
+        heightmapShader.setInt("size", size);
+        heightmapShader.setFloat("spacing", spacing);
+        heightmapShader.setFloat("mapHeight", terrain.chunkHeight);
+        heightmapShader.setInt("octaves", terrain.octaves);
+        heightmapShader.setFloat("frequency", terrain.noiseFrequency());
+        heightmapShader.setFloat("amplitude", terrain.noiseAmplitude());
+        heightmapShader.setFloat("lacunarity", terrain.lacunarity);
+        heightmapShader.setFloat("persistance", terrain.persistance);
+
+        normalmapShader.use();
+        normalmapShader.setInt("size", size);
+        normalmapShader.setFloat("spacing", spacing);
+        glUseProgram(0);
+    }
+
+    ~HeightmapCompute() {
+        glDeleteProgram(heightmapShader.ID);
+        glDeleteProgram(normalmapShader.ID);
+        if (readbackFramebuffer != 0) {
+            glDeleteFramebuffers(1, &readbackFramebuffer);
+            memoryStats().deleted(GPU_FRAMEBUFFER, 1, &readbackFramebuffer);
+        }
+    }
+
+    HeightmapCompute(const HeightmapCompute&) = delete;
+    HeightmapCompute& operator=(const HeightmapCompute&) = delete;
+
+    // Compares every layer generated from now on against the CPU noise, maxError is in world units
+    void enableParityCheck(float maxError) {
+        parityTolerance = maxError;
+        parityCheck = true;
+    }
+
+    // Fills layer of heightmapArray (R32F) and normalmapArray (RGBA8) with the chunk's heights and normals
+    void generate(const terrainChunk& chunk, GLuint heightmapArray, GLuint normalmapArray, int layer) {
+        GLuint groups = (GLuint)(size + 7) / 8;
+        heightmapShader.use();
+        heightmapShader.setVec2("origin", chunk.posX - spacing, chunk.posZ - spacing);
+        glBindImageTexture(0, heightmapArray, 0, GL_FALSE, layer, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute(groups, groups, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        groups = (GLuint)(size + 15) / 16;
+        normalmapShader.use();
+        glBindImageTexture(0, heightmapArray, 0, GL_FALSE, layer, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(1, normalmapArray, 0, GL_FALSE, layer, GL_WRITE_ONLY, GL_RGBA8);
+        glDispatchCompute(groups, groups, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        chunksGenerated++;
+
+        if (parityCheck) {
+            checkParity(chunk, heightmapArray, layer);
+        }
+    }
+
+    int generatedChunks() const {
+        return chunksGenerated;
+    }
+
+    // Largest difference from the CPU heights so far and the number of layers past the tolerance
+    float maxParityError() const {
+        return parityError;
+    }
+
+    int parityFailures() const {
+        return failedChunks;
+    }
+
+private:
+    const Terrain& terrain;
+    Shader heightmapShader;
+    Shader normalmapShader;
+    int size;
+    float spacing;
+    int chunksGenerated = 0;
+    bool parityCheck = false;
+    float parityTolerance = 0.0f;
+    float parityError = 0.0f;
+    int failedChunks = 0;
+    GLuint readbackFramebuffer = 0;
+    std::vector<float> gpuHeights;
+    std::vector<float> cpuHeights;
+
+    void checkParity(const terrainChunk& chunk, GLuint heightmapArray, int layer) {
+        if (readbackFramebuffer == 0) {
+            glGenFramebuffers(1, &readbackFramebuffer);
+            memoryStats().created(GPU_FRAMEBUFFER, 1);
+        }
+        gpuHeights.resize((size_t)size * size);
+        cpuHeights.resize((size_t)size * size);
+
+        GLint previousFramebuffer = 0;
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, readbackFramebuffer);
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, heightmapArray, 0, layer);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glReadPixels(0, 0, size, size, GL_RED, GL_FLOAT, gpuHeights.data());
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, (GLuint)previousFramebuffer);
+
+        // same layout as the layer, rows along x
+        terrain.sampleHeightGrid(chunk.posX - spacing, chunk.posZ - spacing, spacing, size, size, cpuHeights.data());
+        float chunkError = 0.0f;
+        for (size_t i = 0; i < gpuHeights.size(); i++) {
+            chunkError = std::max(chunkError, std::fabs(gpuHeights[i] - cpuHeights[i]));
+        }
+        parityError = std::max(parityError, chunkError);
+        if (chunkError > parityTolerance) {
+            failedChunks++;
+            std::cout << "ERROR GPU HEIGHTFIELD PARITY chunk " << chunk.chunkMapCoords.first << ", " << chunk.chunkMapCoords.second
+                << " differs from the CPU noise by " << chunkError << std::endl;
+        }
+    }
+};
@@ -0,0 +1,737 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <climits>
+#include <utility>
+#include <algorithm>
+#include <iostream>
+
+#include <glad/glad.h>
+
+#include "terrain.h"
+#include "shader.h"
+#include "terraincompute.h"
+#include "memorystats.h"
+
+// Slot bookkeeping shared by the terrain renderers. Every chunk the renderer holds GPU data for owns one fixed size
+// slot, recycled chunks keep theirs and the next upload overwrites it in place.
+class TerrainRenderer {
+public:
+    const std::pair<int, int> NO_OWNER = { INT_MIN, INT_MIN };
+
+    explicit TerrainRenderer(int slotCount) : slotCount(slotCount) {
+        slotOwners.assign(slotCount, NO_OWNER);
+        freeSlots.reserve(slotCount);
+        for (int slot = slotCount - 1; slot >= 0; slot--) {
+            freeSlots.push_back(slot);
+        }
+    }
+
+    virtual ~TerrainRenderer() {
+    }
+
+    TerrainRenderer(const TerrainRenderer&) = delete;
+    TerrainRenderer& operator=(const TerrainRenderer&) = delete;
+
+    // Uploads every chunk in the list that isn't buffered yet, chunks already in their slot cost nothing.
+    // Frames where no new or regenerated chunk arrives upload zero bytes.
+    void uploadPending(const std::vector<terrainChunk*>& chunks) {
+        TRACE_SCOPE("uploadPending");
+        frameUploadChunks = 0;
+        frameUploadBytes = 0;
+        for (terrainChunk* chunk : chunks) {
+            if (!chunk->buffered) {
+                TRACE_SCOPE("upload chunk");
+                upload(chunk);
+            }
+        }
+    }
+
+    // Copies the chunk's data into its slot, taking a free slot first if it doesn't have one.
+    // Returns false if the renderer is out of slots, the chunk is left unbuffered and can be retried.
+    virtual bool upload(terrainChunk* chunk) = 0;
+
+    // Draws every buffered chunk in the list, unbuffered chunks are skipped
+    virtual void drawBatch(const std::vector<terrainChunk*>& chunks) = 0;
+
+    // Sets the uniforms the renderer's shader needs to find the chunk data, the shader must be in use
+    virtual void setUniforms(const Shader& shader) const = 0;
+
+    // Returns the chunk's slot to the free list
+    void release(terrainChunk* chunk) {
+        if (chunk->gpuSlot < 0) {
+            return;
+        }
+        freeSlots.push_back(chunk->gpuSlot);
+        slotOwners[chunk->gpuSlot] = NO_OWNER;
+        chunk->gpuSlot = -1;
+        chunk->gpuVertexBytes = 0;
+        chunk->gpuIndexBytes = 0;
+        chunk->buffered = false;
+    }
+
+    // Chunk map coordinates of the chunk whose data is in the slot, NO_OWNER if it is free
+    std::pair<int, int> slotOwner(int slot) const {
+        return slotOwners[slot];
+    }
+
+    // Upload counters for the last uploadPending call
+    int uploadedChunks() const {
+        return frameUploadChunks;
+    }
+
+    size_t uploadedBytes() const {
+        return frameUploadBytes;
+    }
+
+    size_t totalUploadedBytes() const {
+        return totalUploadBytes;
+    }
+
+    // renderers keeping a texture array layer per slot can't have more slots than this
+    static int maxTextureLayers() {
+        GLint layers = 0;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &layers);
+        return layers;
+    }
+
+    // texels a buffer texture can reach, GL 3.3 only promises 65536, texelFetch past the end reads zeros
+    static int maxTextureBufferTexels() {
+        GLint texels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &texels);
+        return texels;
+    }
+
+    int freeSlotCount() const {
+        return (int)freeSlots.size();
+    }
+
+    int getSlotCount() const {
+        return slotCount;
+    }
+
+protected:
+    int slotCount;
+
+    // Gives the chunk a slot if it has none and records it as the slot's owner, false if no slot is free
+    bool claimSlot(terrainChunk* chunk) {
+        if (chunk->gpuSlot < 0) {
+            if (freeSlots.empty()) {
+                return false;
+            }
+            chunk->gpuSlot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        slotOwners[chunk->gpuSlot] = chunk->chunkMapCoords; // recycled chunks carry their slot over to new coordinates
+        return true;
+    }
+
+    void countUpload(terrainChunk* chunk, size_t bytes) {
+        chunk->buffered = true;
+        frameUploadChunks++;
+        frameUploadBytes += bytes;
+        totalUploadBytes += bytes;
+    }
+
+    // slotCount clamped to maxTextureLayers. Chunks past the clamp wait for a slot forever and show as holes, the
+    // application checks before picking a texture array renderer so this only reports it.
+    static int textureArraySlots(int slotCount) {
+        int layers = maxTextureLayers();
+        if (layers < slotCount) {
+            std::cout << "ERROR TERRAIN NEEDS " << slotCount << " TEXTURE ARRAY LAYERS, THE GPU HAS " << layers << std::endl;
+        }
+        return std::min(slotCount, layers);
+    }
+
+    // slotCount clamped to maxTextureBufferTexels, for renderers keeping a buffer texture texel per slot
+    static int textureBufferSlots(int slotCount) {
+        int texels = maxTextureBufferTexels();
+        if (texels < slotCount) {
+            std::cout << "ERROR TERRAIN NEEDS " << slotCount << " TEXTURE BUFFER TEXELS, THE GPU HAS " << texels << std::endl;
+        }
+        return std::min(slotCount, texels);
+    }
+
+private:
+    std::vector<int> freeSlots;
+    std::vector<std::pair<int, int>> slotOwners;
+    int frameUploadChunks = 0;
+    size_t frameUploadBytes = 0;
+    size_t totalUploadBytes = 0;
+};
+
+// One vertex buffer and one index buffer shared by every terrain chunk, carved into fixed size slots.
+// A chunk's indices stay local to the chunk and are offset with baseVertex when drawn, so all chunks
+// draw from the same VAO with one multi-draw and uploads never create or resize GL objects.
+// Shared-vertex chunks carry no indices of their own, they draw with the level of detail index lists
+// stored once after the slots.
+// Per-chunk data lives in a texture buffer indexed by slot, chunkmap.vert finds the slot from gl_VertexID.
+// The vertex buffer is also viewed as a texture buffer so chunkmap.vert can read the heights it morphs to, when it has
+// more texels than GL_MAX_TEXTURE_BUFFER_SIZE the levels of detail switch without morphing instead.
+class TerrainGeometryPool : public TerrainRenderer {
+public:
+    static const int CHUNK_DATA_TEXTURE_UNIT = 1; // grass is on unit 0
+    static const int PACKED_VERTEX_DATA_TEXTURE_UNIT = 2; // separate units since the two views have different sampler types
+    static const int FLOAT_VERTEX_DATA_TEXTURE_UNIT = 3;
+
+    TerrainGeometryPool(int slotCount, int slotVertices, int slotIndices, const std::vector<std::vector<unsigned int>>& lodIndexLists, Terrain_Vertex_Format vertexFormat) :
+        TerrainRenderer(textureBufferSlots(slotCount)),
+        slotVertices(slotVertices),
+        slotIndices(slotIndices),
+        vertexStride(terrainVertexStride(vertexFormat)),
+        vertexFormat(vertexFormat) {
+        size_t lodIndexTotal = 0;
+        for (const std::vector<unsigned int>& indices : lodIndexLists) {
+            lodIndexOffsets.push_back((void*)(((size_t)this->slotCount * slotIndices + lodIndexTotal) * sizeof(unsigned int)));
+            lodIndexCounts.push_back((GLsizei)indices.size());
+            lodIndexTotal += indices.size();
+        }
+
+        glGenVertexArrays(1, &VAO);
+        memoryStats().created(GPU_VERTEX_ARRAY, 1);
+        glBindVertexArray(VAO);
+
+        glGenBuffers(1, &VBO);
+        memoryStats().created(GPU_BUFFER, 1);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        allocateStorage(GL_ARRAY_BUFFER, VBO, "terrain vertex slots", (GLsizeiptr)this->slotCount * slotVertices * vertexStride);
+
+        glGenBuffers(1, &EBO);
+        memoryStats().created(GPU_BUFFER, 1);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        allocateStorage(GL_ELEMENT_ARRAY_BUFFER, EBO, "terrain index slots", (GLsizeiptr)((size_t)this->slotCount * slotIndices + lodIndexTotal) * sizeof(unsigned int));
+        for (size_t level = 0; level < lodIndexLists.size(); level++) {
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (GLintptr)lodIndexOffsets[level], lodIndexLists[level].size() * sizeof(unsigned int), lodIndexLists[level].data());
+        }
+
+        // Set up the vertex attributes
+        if (vertexFormat == PACKED_VERTEX) {
+            // lattice x/z attribute
+            glVertexAttribIPointer(3, 2, GL_UNSIGNED_SHORT, sizeof(packedTerrainVertex), (void*)offsetof(packedTerrainVertex, x));
+            glEnableVertexAttribArray(3);
+
+            // normalized height attribute
+            glVertexAttribPointer(4, 1, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(packedTerrainVertex), (void*)offsetof(packedTerrainVertex, height));
+            glEnableVertexAttribArray(4);
+
+            // octahedral normal attribute
+            glVertexAttribPointer(5, 2, GL_BYTE, GL_TRUE, sizeof(packedTerrainVertex), (void*)offsetof(packedTerrainVertex, normal));
+            glEnableVertexAttribArray(5);
+        }
+        else {
+            // position attribute
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+            glEnableVertexAttribArray(0);
+
+            // normal attribute
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+            glEnableVertexAttribArray(1);
+
+            // texture attribute
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+            glEnableVertexAttribArray(2);
+        }
+        glBindVertexArray(0);
+
+        // chunk origin x, origin z and level of detail per slot
+        chunkData.assign((size_t)this->slotCount * 4, 0.0f);
+        glGenBuffers(1, &chunkDataBuffer);
+        memoryStats().created(GPU_BUFFER, 1);
+        glBindBuffer(GL_TEXTURE_BUFFER, chunkDataBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, chunkData.size() * sizeof(float), chunkData.data(), GL_DYNAMIC_DRAW);
+        memoryStats().allocated(GPU_BUFFER, chunkDataBuffer, "terrain chunk data", chunkData.size() * sizeof(float));
+        // buffer textures are views of a buffer, they have no storage of their own
+        glGenTextures(1, &chunkDataTexture);
+        memoryStats().created(GPU_TEXTURE, 1);
+        glBindTexture(GL_TEXTURE_BUFFER, chunkDataTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, chunkDataBuffer);
+
+        // one RGBA16UI texel per packed vertex, two RGBA32F texels per float vertex
+        glGenTextures(1, &vertexDataTexture);
+        memoryStats().created(GPU_TEXTURE, 1);
+        glBindTexture(GL_TEXTURE_BUFFER, vertexDataTexture);
+        size_t vertexTexels = (size_t)this->slotCount * slotVertices * (vertexFormat == PACKED_VERTEX ? 1 : 2);
+        lodMorph = vertexTexels <= (size_t)maxTextureBufferTexels();
+        if (lodMorph) {
+            glTexBuffer(GL_TEXTURE_BUFFER, vertexFormat == PACKED_VERTEX ? GL_RGBA16UI : GL_RGBA32F, VBO);
+        }
+        else {
+            std::cout << "ERROR TERRAIN VERTEX BUFFER NEEDS " << vertexTexels << " TEXTURE BUFFER TEXELS, THE GPU HAS "
+                << maxTextureBufferTexels() << ", LEVEL OF DETAIL MORPHING IS OFF" << std::endl;
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+
+    ~TerrainGeometryPool() {
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteTextures(1, &chunkDataTexture);
+        glDeleteTextures(1, &vertexDataTexture);
+        glDeleteBuffers(1, &chunkDataBuffer);
+        memoryStats().deleted(GPU_VERTEX_ARRAY, 1, &VAO);
+        GLuint buffers[] = { VBO, EBO, chunkDataBuffer };
+        memoryStats().deleted(GPU_BUFFER, 3, buffers);
+        GLuint textures[] = { chunkDataTexture, vertexDataTexture };
+        memoryStats().deleted(GPU_TEXTURE, 2, textures);
+    }
+
+    // Copies the chunk's geometry into its slot
+    bool upload(terrainChunk* chunk) override {
+        if (!claimSlot(chunk)) {
+            return false;
+        }
+        chunk->gpuVertexBytes = (size_t)slotVertices * vertexStride;
+        chunk->gpuIndexBytes = (size_t)slotIndices * sizeof(unsigned int);
+
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)chunk->gpuSlot * chunk->gpuVertexBytes, chunk->vertexBytes(), chunk->vertexData());
+
+        if (!chunk->indices.empty()) {
+            glBindVertexArray(VAO);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (GLintptr)chunk->gpuSlot * chunk->gpuIndexBytes, chunk->indices.size() * sizeof(unsigned int), &chunk->indices[0]);
+        }
+
+        float* slotData = &chunkData[(size_t)chunk->gpuSlot * 4];
+        slotData[0] = (float)chunk->posX;
+        slotData[1] = (float)chunk->posZ;
+        slotData[2] = (float)chunk->lodLevel;
+        glBindBuffer(GL_TEXTURE_BUFFER, chunkDataBuffer);
+        glBufferSubData(GL_TEXTURE_BUFFER, (GLintptr)chunk->gpuSlot * 4 * sizeof(float), 4 * sizeof(float), slotData);
+
+        countUpload(chunk, chunk->vertexBytes() + chunk->indices.size() * sizeof(unsigned int));
+        return true;
+    }
+
+    // Draws every buffered chunk in the list with a single glMultiDrawElementsBaseVertex
+    void drawBatch(const std::vector<terrainChunk*>& chunks) override {
+        drawCounts.clear();
+        drawOffsets.clear();
+        drawBaseVertices.clear();
+        bool levelsChanged = false;
+        for (const terrainChunk* chunk : chunks) {
+            if (!chunk->buffered) {
+                continue;
+            }
+            float& slotLevel = chunkData[(size_t)chunk->gpuSlot * 4 + 2];
+            if (slotLevel != (float)chunk->lodLevel) {
+                slotLevel = (float)chunk->lodLevel;
+                levelsChanged = true;
+            }
+
+            if (lodIndexCounts.empty()) {
+                drawCounts.push_back((GLsizei)chunk->indexCount);
+                drawOffsets.push_back(indexOffset(chunk->gpuSlot));
+            }
+            else {
+                drawCounts.push_back(lodIndexCounts[chunk->lodLevel]);
+                drawOffsets.push_back(lodIndexOffsets[chunk->lodLevel]);
+            }
+            drawBaseVertices.push_back(baseVertex(chunk->gpuSlot));
+        }
+        if (drawCounts.empty()) {
+            return;
+        }
+
+        // levels only change as the camera moves across range boundaries, the whole table is a few KB
+        if (levelsChanged) {
+            glBindBuffer(GL_TEXTURE_BUFFER, chunkDataBuffer);
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, chunkData.size() * sizeof(float), chunkData.data());
+        }
+
+        glBindVertexArray(VAO);
+        glActiveTexture(GL_TEXTURE0 + (vertexFormat == PACKED_VERTEX ? PACKED_VERTEX_DATA_TEXTURE_UNIT : FLOAT_VERTEX_DATA_TEXTURE_UNIT));
+        glBindTexture(GL_TEXTURE_BUFFER, vertexDataTexture);
+        glActiveTexture(GL_TEXTURE0 + CHUNK_DATA_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_BUFFER, chunkDataTexture);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawCounts.data(), GL_UNSIGNED_INT, drawOffsets.data(), (GLsizei)drawCounts.size(), drawBaseVertices.data());
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void setUniforms(const Shader& shader) const override {
+        shader.setBool("heightmapGrid", false);
+        shader.setBool("lodMorph", lodMorph);
+        shader.setInt("chunkData", CHUNK_DATA_TEXTURE_UNIT);
+        shader.setInt("slotVertices", slotVertices);
+        shader.setInt("packedVertexData", PACKED_VERTEX_DATA_TEXTURE_UNIT);
+        shader.setInt("floatVertexData", FLOAT_VERTEX_DATA_TEXTURE_UNIT);
+    }
+
+    int getSlotVertices() const {
+        return slotVertices;
+    }
+
+    GLint baseVertex(int slot) const {
+        return slot * slotVertices;
+    }
+
+    void* indexOffset(int slot) const {
+        return (void*)((size_t)slot * slotIndices * sizeof(unsigned int));
+    }
+
+private:
+    int slotVertices;
+    int slotIndices;
+    size_t vertexStride;
+    Terrain_Vertex_Format vertexFormat;
+    std::vector<void*> lodIndexOffsets;
+    std::vector<GLsizei> lodIndexCounts;
+    std::vector<float> chunkData;
+    GLuint vertexDataTexture = 0;
+    bool lodMorph = true; // false when the vertex buffer is too big to view as a buffer texture
+    GLuint VAO = 0;
+    GLuint VBO = 0;
+    GLuint EBO = 0;
+    GLuint chunkDataBuffer = 0;
+    GLuint chunkDataTexture = 0;
+    std::vector<GLsizei> drawCounts;
+    std::vector<void*> drawOffsets;
+    std::vector<GLint> drawBaseVertices;
+
+    // Immutable storage where the context has it, otherwise a single glBufferData that is never resized
+    void allocateStorage(GLenum target, GLuint buffer, const char* label, GLsizeiptr bytes) {
+        if (GLAD_GL_VERSION_4_4) {
+            glBufferStorage(target, bytes, nullptr, GL_DYNAMIC_STORAGE_BIT);
+        }
+        else {
+            glBufferData(target, bytes, nullptr, GL_STATIC_DRAW);
+        }
+        memoryStats().allocated(GPU_BUFFER, buffer, label, (size_t)bytes);
+    }
+};
+
+// Renderer for TESSELLATED_PATCHES. Every chunk's heightfield is one layer of a heightmap texture array and every chunk
+// draws the same static grid of patches, so an upload is a single glTexSubImage3D and the whole terrain is one
+// instanced draw with the chunk origin and layer per instance. chunkmap.tcs picks the detail from the camera distance.
+// With a HeightmapCompute (GPU_HEIGHTFIELD) the layers are generated in place instead of uploaded, along with a
+// normal map array the tessellation evaluation shader reads instead of differencing the heights.
+class TerrainPatchRenderer : public TerrainRenderer {
+public:
+    static const int HEIGHTMAP_TEXTURE_UNIT = 1; // grass is on unit 0
+    static const int NORMALMAP_TEXTURE_UNIT = 2;
+    static const int PATCHES_PER_SIDE = 5;
+
+    TerrainPatchRenderer(int slotCount, int heightmapSize, float heightmapSpacing, int chunkSize, HeightmapCompute* compute = nullptr) :
+        TerrainRenderer(textureArraySlots(slotCount)),
+        heightmapSize(heightmapSize),
+        heightmapSpacing(heightmapSpacing),
+        chunkSize(chunkSize),
+        compute(compute) {
+        // patch corners inside a chunk, four indices per patch in the order chunkmap.tes interpolates them
+        int cornersPerSide = PATCHES_PER_SIDE + 1;
+        float patchSize = (float)chunkSize / PATCHES_PER_SIDE;
+        std::vector<float> corners;
+        for (int i = 0; i < cornersPerSide; i++) {
+            for (int j = 0; j < cornersPerSide; j++) {
+                corners.push_back(i * patchSize);
+                corners.push_back(j * patchSize);
+            }
+        }
+        std::vector<unsigned int> indices;
+        auto cornerAt = [cornersPerSide](int i, int j) { return (unsigned int)(i * cornersPerSide + j); };
+        for (int i = 0; i < PATCHES_PER_SIDE; i++) {
+            for (int j = 0; j < PATCHES_PER_SIDE; j++) {
+                indices.push_back(cornerAt(i, j));
+                indices.push_back(cornerAt(i + 1, j));
+                indices.push_back(cornerAt(i, j + 1));
+                indices.push_back(cornerAt(i + 1, j + 1));
+            }
+        }
+        patchIndexCount = (GLsizei)indices.size();
+
+        glGenVertexArrays(1, &VAO);
+        memoryStats().created(GPU_VERTEX_ARRAY, 1);
+        glBindVertexArray(VAO);
+
+        glGenBuffers(1, &patchVBO);
+        memoryStats().created(GPU_BUFFER, 1);
+        glBindBuffer(GL_ARRAY_BUFFER, patchVBO);
+        glBufferData(GL_ARRAY_BUFFER, corners.size() * sizeof(float), corners.data(), GL_STATIC_DRAW);
+        memoryStats().allocated(GPU_BUFFER, patchVBO, "terrain patch corners", corners.size() * sizeof(float));
+        // patch corner attribute
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+
+        glGenBuffers(1, &EBO);
+        memoryStats().created(GPU_BUFFER, 1);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+        memoryStats().allocated(GPU_BUFFER, EBO, "terrain patch indices", indices.size() * sizeof(unsigned int));
+
+        glGenBuffers(1, &instanceVBO);
+        memoryStats().created(GPU_BUFFER, 1);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        // chunk origin x, origin z and heightmap layer attribute, one per instance
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribDivisor(1, 1);
+        glBindVertexArray(0);
+
+        glGenTextures(1, &heightmapTexture);
+        memoryStats().created(GPU_TEXTURE, 1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, heightmapTexture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, heightmapSize, heightmapSize, this->slotCount, 0, GL_RED, GL_FLOAT, nullptr);
+        memoryStats().allocated(GPU_TEXTURE, heightmapTexture, "terrain heightmaps", MemoryStats::textureBytes(heightmapSize, heightmapSize, this->slotCount, sizeof(float), false));
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        if (compute != nullptr) {
+            glGenTextures(1, &normalmapTexture);
+            memoryStats().created(GPU_TEXTURE, 1);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, normalmapTexture);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, heightmapSize, heightmapSize, this->slotCount, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            memoryStats().allocated(GPU_TEXTURE, normalmapTexture, "terrain normal maps", MemoryStats::textureBytes(heightmapSize, heightmapSize, this->slotCount, 4, false));
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    ~TerrainPatchRenderer() {
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &patchVBO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteBuffers(1, &instanceVBO);
+        glDeleteTextures(1, &heightmapTexture);
+        if (normalmapTexture != 0) {
+            glDeleteTextures(1, &normalmapTexture);
+        }
+        memoryStats().deleted(GPU_VERTEX_ARRAY, 1, &VAO);
+        GLuint buffers[] = { patchVBO, EBO, instanceVBO };
+        memoryStats().deleted(GPU_BUFFER, 3, buffers);
+        GLuint textures[] = { heightmapTexture, normalmapTexture };
+        memoryStats().deleted(GPU_TEXTURE, 2, textures);
+    }
+
+    // Copies the chunk's heightfield into its layer, apron included so normals match across chunk borders
+    bool upload(terrainChunk* chunk) override {
+        if (!claimSlot(chunk)) {
+            return false;
+        }
+        size_t layerBytes = (size_t)heightmapSize * heightmapSize * sizeof(float);
+        chunk->gpuIndexBytes = 0;
+
+        if (compute != nullptr) {
+            chunk->gpuVertexBytes = layerBytes + (size_t)heightmapSize * heightmapSize * 4; // plus the RGBA8 normals
+            compute->generate(*chunk, heightmapTexture, normalmapTexture, chunk->gpuSlot);
+            countUpload(chunk, 0); // nothing crosses the bus
+            return true;
+        }
+        chunk->gpuVertexBytes = layerBytes;
+
+        // heightfield rows run along x, so texel (s, t) is lattice point (t - 1, s - 1)
+        glBindTexture(GL_TEXTURE_2D_ARRAY, heightmapTexture);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, chunk->gpuSlot, heightmapSize, heightmapSize, 1, GL_RED, GL_FLOAT, chunk->heightfield.data());
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        countUpload(chunk, layerBytes);
+        return true;
+    }
+
+    // One instanced glDrawElementsInstanced of GL_PATCHES over every buffered chunk
+    void drawBatch(const std::vector<terrainChunk*>& chunks) override {
+        instances.clear();
+        for (const terrainChunk* chunk : chunks) {
+            if (!chunk->buffered) {
+                continue;
+            }
+            instances.push_back((float)chunk->posX);
+            instances.push_back((float)chunk->posZ);
+            instances.push_back((float)chunk->gpuSlot);
+        }
+        if (instances.empty()) {
+            return;
+        }
+
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(float), instances.data(), GL_STREAM_DRAW);
+        memoryStats().allocated(GPU_BUFFER, instanceVBO, "terrain instances", instances.size() * sizeof(float));
+        glActiveTexture(GL_TEXTURE0 + HEIGHTMAP_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, heightmapTexture);
+        if (normalmapTexture != 0) {
+            glActiveTexture(GL_TEXTURE0 + NORMALMAP_TEXTURE_UNIT);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, normalmapTexture);
+        }
+        glPatchParameteri(GL_PATCH_VERTICES, 4);
+        glDrawElementsInstanced(GL_PATCHES, patchIndexCount, GL_UNSIGNED_INT, 0, (GLsizei)(instances.size() / 3));
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void setUniforms(const Shader& shader) const override {
+        shader.setInt("heightMap", HEIGHTMAP_TEXTURE_UNIT);
+        shader.setInt("normalMap", NORMALMAP_TEXTURE_UNIT);
+        shader.setBool("normalMapped", normalmapTexture != 0);
+        shader.setInt("heightmapSize", heightmapSize);
+        shader.setFloat("heightmapSpacing", heightmapSpacing);
+        shader.setFloat("patchSize", (float)chunkSize / PATCHES_PER_SIDE);
+    }
+
+private:
+    int heightmapSize;
+    float heightmapSpacing;
+    int chunkSize;
+    HeightmapCompute* compute;
+    GLsizei patchIndexCount = 0;
+    GLuint VAO = 0;
+    GLuint patchVBO = 0;
+    GLuint EBO = 0;
+    GLuint instanceVBO = 0;
+    GLuint heightmapTexture = 0;
+    GLuint normalmapTexture = 0;
+    std::vector<float> instances;
+};
+
+// Renderer for HEIGHTMAP_GRID. The lattice is the same for every chunk so it is never stored anywhere, chunkmap.vert
+// derives x/z from gl_VertexID and reads heights (and their central difference normals, the apron covers the borders)
+// from the chunk's layer of an R32F heightmap array. An upload is one glTexSubImage3D of the chunk's heightfield.
+// Chunks draw with the level of detail index lists, one glDrawElementsInstanced per level with the chunk origin, level
+// and layer per instance.
+class TerrainGridRenderer : public TerrainRenderer {
+public:
+    static const int HEIGHTMAP_TEXTURE_UNIT = 4; // past the geometry pool's units, chunkmap.vert declares both sets
+
+    TerrainGridRenderer(int slotCount, int heightmapSize, const std::vector<std::vector<unsigned int>>& lodIndexLists) :
+        TerrainRenderer(textureArraySlots(slotCount)),
+        heightmapSize(heightmapSize) {
+        size_t lodIndexTotal = 0;
+        for (const std::vector<unsigned int>& indices : lodIndexLists) {
+            lodIndexOffsets.push_back((void*)(lodIndexTotal * sizeof(unsigned int)));
+            lodIndexCounts.push_back((GLsizei)indices.size());
+            lodIndexTotal += indices.size();
+        }
+
+        glGenVertexArrays(1, &VAO);
+        memoryStats().created(GPU_VERTEX_ARRAY, 1);
+        glBindVertexArray(VAO);
+
+        glGenBuffers(1, &EBO);
+        memoryStats().created(GPU_BUFFER, 1);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, lodIndexTotal * sizeof(unsigned int), nullptr, GL_STATIC_DRAW);
+        memoryStats().allocated(GPU_BUFFER, EBO, "terrain lod indices", lodIndexTotal * sizeof(unsigned int));
+        for (size_t level = 0; level < lodIndexLists.size(); level++) {
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (GLintptr)lodIndexOffsets[level], lodIndexLists[level].size() * sizeof(unsigned int), lodIndexLists[level].data());
+        }
+
+        // chunk origin x, origin z, level of detail and heightmap layer attribute, one per instance.
+        // The pointer is moved to each level's first instance before its draw.
+        glGenBuffers(1, &instanceVBO);
+        memoryStats().created(GPU_BUFFER, 1);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(6);
+        glVertexAttribDivisor(6, 1);
+        glBindVertexArray(0);
+
+        glGenTextures(1, &heightmapTexture);
+        memoryStats().created(GPU_TEXTURE, 1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, heightmapTexture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, heightmapSize, heightmapSize, this->slotCount, 0, GL_RED, GL_FLOAT, nullptr);
+        memoryStats().allocated(GPU_TEXTURE, heightmapTexture, "terrain heightmaps", MemoryStats::textureBytes(heightmapSize, heightmapSize, this->slotCount, sizeof(float), false));
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        levelInstances.resize(lodIndexLists.size());
+    }
+
+    ~TerrainGridRenderer() {
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteBuffers(1, &instanceVBO);
+        glDeleteTextures(1, &heightmapTexture);
+        memoryStats().deleted(GPU_VERTEX_ARRAY, 1, &VAO);
+        GLuint buffers[] = { EBO, instanceVBO };
+        memoryStats().deleted(GPU_BUFFER, 2, buffers);
+        memoryStats().deleted(GPU_TEXTURE, 1, &heightmapTexture);
+    }
+
+    // Copies the chunk's heightfield into its layer
+    bool upload(terrainChunk* chunk) override {
+        if (!claimSlot(chunk)) {
+            return false;
+        }
+        size_t layerBytes = (size_t)heightmapSize * heightmapSize * sizeof(float);
+        chunk->gpuVertexBytes = layerBytes;
+        chunk->gpuIndexBytes = 0;
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, heightmapTexture);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, chunk->gpuSlot, heightmapSize, heightmapSize, 1, GL_RED, GL_FLOAT, chunk->heightfield.data());
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        countUpload(chunk, layerBytes);
+        return true;
+    }
+
+    // One instanced draw per level of detail in use
+    void drawBatch(const std::vector<terrainChunk*>& chunks) override {
+        for (std::vector<const terrainChunk*>& level : levelInstances) {
+            level.clear();
+        }
+        for (const terrainChunk* chunk : chunks) {
+            if (chunk->buffered) {
+                levelInstances[chunk->lodLevel].push_back(chunk);
+            }
+        }
+
+        instances.clear();
+        for (size_t level = 0; level < levelInstances.size(); level++) {
+            for (const terrainChunk* chunk : levelInstances[level]) {
+                instances.push_back((float)chunk->posX);
+                instances.push_back((float)chunk->posZ);
+                instances.push_back((float)level);
+                instances.push_back((float)chunk->gpuSlot);
+            }
+        }
+        if (instances.empty()) {
+            return;
+        }
+
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(float), instances.data(), GL_STREAM_DRAW);
+        memoryStats().allocated(GPU_BUFFER, instanceVBO, "terrain instances", instances.size() * sizeof(float));
+        glActiveTexture(GL_TEXTURE0 + HEIGHTMAP_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, heightmapTexture);
+
+        size_t firstInstance = 0;
+        for (size_t level = 0; level < levelInstances.size(); level++) {
+            GLsizei count = (GLsizei)levelInstances[level].size();
+            if (count == 0) {
+                continue;
+            }
+            glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(firstInstance * 4 * sizeof(float)));
+            glDrawElementsInstanced(GL_TRIANGLES, lodIndexCounts[level], GL_UNSIGNED_INT, lodIndexOffsets[level], count);
+            firstInstance += count;
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void setUniforms(const Shader& shader) const override {
+        shader.setBool("heightmapGrid", true);
+        shader.setBool("lodMorph", true); // the heights come from the texture array, not a buffer texture
+        shader.setInt("heightMap", HEIGHTMAP_TEXTURE_UNIT);
+        // unused in this mode, but samplers of different types can't be left sharing unit 0
+        shader.setInt("chunkData", TerrainGeometryPool::CHUNK_DATA_TEXTURE_UNIT);
+        shader.setInt("packedVertexData", TerrainGeometryPool::PACKED_VERTEX_DATA_TEXTURE_UNIT);
+        shader.setInt("floatVertexData", TerrainGeometryPool::FLOAT_VERTEX_DATA_TEXTURE_UNIT);
+    }
+
+private:
+    int heightmapSize;
+    std::vector<void*> lodIndexOffsets;
+    std::vector<GLsizei> lodIndexCounts;
+    GLuint VAO = 0;
+    GLuint EBO = 0;
+    GLuint instanceVBO = 0;
+    GLuint heightmapTexture = 0;
+    std::vector<std::vector<const terrainChunk*>> levelInstances;
+    std::vector<float> instances;
+};
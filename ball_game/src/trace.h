@@ -0,0 +1,212 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <set>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+
+// Timeline tracing, written out as Chrome trace-event JSON for chrome://tracing or ui.perfetto.dev.
+//
+//   TRACE_SCOPE("name");   times the rest of the enclosing block as one event on the calling thread
+//
+// Names must outlive the trace, string literals or Tracer::intern. Each thread appends to its own ring of
+// EVENTS_PER_THREAD events with no locks, the ring is registered once under a mutex the first time the thread records
+// anything. A full ring overwrites its oldest events so a dump always has the most recent window, clear starts a new
+// window without touching the writers. While tracing is off a scope costs one relaxed load and one branch, defining
+// TRACE_DISABLED compiles the scopes out entirely.
+class Tracer {
+public:
+    static const uint32_t EVENTS_PER_THREAD = 1 << 18; // power of two, ring indices are masked
+
+    struct event {
+        const char* name;
+        int64_t start;      // steady_clock nanoseconds
+        int64_t duration;
+    };
+
+    static Tracer& instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    static bool enabled() {
+        return enabledFlag().load(std::memory_order_relaxed);
+    }
+
+    void setEnabled(bool on) {
+        enabledFlag().store(on, std::memory_order_relaxed);
+    }
+
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Appends a finished event to the calling thread's ring, over the oldest one once the ring is full
+    void record(const char* name, int64_t start, int64_t end) {
+        threadBuffer* buffer = currentThreadBuffer();
+        uint64_t index = buffer->written.load(std::memory_order_relaxed);
+        buffer->events[index & (EVENTS_PER_THREAD - 1)] = event{ name, start, end - start };
+        buffer->written.store(index + 1, std::memory_order_release); // the writer publishes the event only once it is written
+    }
+
+    // Forgets every event recorded so far, the next dump starts from here
+    void clear() {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (auto& buffer : buffers) {
+            buffer->windowStart.store(buffer->written.load(std::memory_order_acquire), std::memory_order_relaxed);
+        }
+    }
+
+    // Label for the calling thread's row in the timeline, costs nothing until the thread records an event
+    void setThreadName(const std::string& name) {
+        threadState& state = currentThread();
+        std::lock_guard<std::mutex> lock(registryMutex);
+        state.name = name;
+        if (state.buffer != nullptr) {
+            state.buffer->name = name;
+        }
+    }
+
+    // A name that lives as long as the tracer, for events named at runtime
+    const char* intern(const std::string& name) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        return internedNames.insert(name).first->c_str();
+    }
+
+    // Writes the events since the last clear that are still in their rings, recording can carry on on other threads
+    // while this runs. Events stay in their rings, a later dump without a clear in between includes them again.
+    bool writeChromeJson(const std::string& path) {
+        FILE* file = std::fopen(path.c_str(), "w");
+        if (file == nullptr) {
+            std::cout << "ERROR TRACE COULD NOT BE WRITTEN " << path << std::endl;
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+        std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        bool first = true;
+        unsigned long long overwritten = 0;
+        std::vector<event> window;
+        for (size_t thread = 0; thread < buffers.size(); thread++) {
+            const threadBuffer& buffer = *buffers[thread];
+            std::string threadName = buffer.name.empty() ? "thread " + std::to_string(thread) : buffer.name;
+            std::fprintf(file, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", thread, escaped(threadName).c_str());
+            first = false;
+
+            // copy the window out first, then drop whatever the writer lapped while it was being copied
+            uint64_t windowStart = buffer.windowStart.load(std::memory_order_relaxed);
+            uint64_t end = buffer.written.load(std::memory_order_acquire);
+            uint64_t begin = std::max(windowStart, end > EVENTS_PER_THREAD ? end - EVENTS_PER_THREAD : 0);
+            window.clear();
+            for (uint64_t i = begin; i < end; i++) {
+                window.push_back(buffer.events[i & (EVENTS_PER_THREAD - 1)]);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t after = buffer.written.load(std::memory_order_relaxed);
+            uint64_t intact = after >= EVENTS_PER_THREAD ? after - EVENTS_PER_THREAD + 1 : 0; // slot of index after is being written
+            size_t skip = intact > begin ? (size_t)std::min<uint64_t>(intact - begin, window.size()) : 0;
+            overwritten += (begin - windowStart) + skip;
+
+            for (size_t i = skip; i < window.size(); i++) {
+                const event& timed = window[i];
+                std::fprintf(file, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"name\":\"%s\",\"ts\":%.3f,\"dur\":%.3f}",
+                    thread, escaped(timed.name).c_str(), timed.start / 1000.0, timed.duration / 1000.0);
+            }
+        }
+        std::fprintf(file, "\n],\"otherData\":{\"overwrittenEvents\":%llu}}\n", overwritten);
+        std::fclose(file);
+        return true;
+    }
+
+private:
+    struct threadBuffer {
+        std::unique_ptr<event[]> events{ new event[EVENTS_PER_THREAD] };
+        std::atomic<uint64_t> written{ 0 };     // events ever recorded, event i is in slot i % EVENTS_PER_THREAD
+        std::atomic<uint64_t> windowStart{ 0 }; // written at the last clear
+        std::string name;
+    };
+
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<threadBuffer>> buffers; // kept after their threads exit so a dump at exit still has them
+    std::set<std::string> internedNames;
+
+    Tracer() = default;
+
+    // constant initialized, reading it needs no guard
+    static std::atomic<bool>& enabledFlag() {
+        static std::atomic<bool> flag{ false };
+        return flag;
+    }
+
+    struct threadState {
+        threadBuffer* buffer = nullptr;
+        std::string name;
+    };
+
+    static threadState& currentThread() {
+        thread_local threadState state;
+        return state;
+    }
+
+    threadBuffer* currentThreadBuffer() {
+        threadState& state = currentThread();
+        if (state.buffer == nullptr) {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            buffers.emplace_back(new threadBuffer());
+            state.buffer = buffers.back().get();
+            state.buffer->name = state.name;
+        }
+        return state.buffer;
+    }
+
+    static std::string escaped(const std::string& text) {
+        std::string result;
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                result += '\\';
+            }
+            result += c;
+        }
+        return result;
+    }
+};
+
+// One trace event covering the object's lifetime, use TRACE_SCOPE rather than naming these
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name(Tracer::enabled() ? name : nullptr) {
+        if (this->name != nullptr) {
+            start = Tracer::now();
+        }
+    }
+
+    ~TraceScope() {
+        if (name != nullptr) {
+            Tracer::instance().record(name, start, Tracer::now());
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    int64_t start = 0;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifdef TRACE_DISABLED
+#define TRACE_SCOPE(name) ((void)0)
+#else
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#endif
@@ -1,6 +1,7 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aChunkPosition; // per instance, one instance per chunk with water
 
 out vec3 Normal;
 out vec3 Position;
@@ -12,6 +13,6 @@ uniform mat4 projection;
 void main()
 {
     Normal = mat3(transpose(inverse(model))) * aNormal;
-    Position = vec3(model * vec4(aPos, 1.0));
+    Position = vec3(model * vec4(aPos + vec3(aChunkPosition.x, 0.0, aChunkPosition.y), 1.0));
     gl_Position = projection * view * vec4(Position, 1.0);
 }  
\ No newline at end of file
@@ -0,0 +1,231 @@
+// Microbenchmarks for the CPU side of terrain generation, SimplexNoise and Terrain::generateChunkAt.
+// No window or GL context, builds from SimplexNoise.cpp, mappedfile.cpp and the terrain headers only.
+//
+//   terrain_bench [--json] [--quick] [--threads N]
+//
+// --json prints the results as a JSON array instead of a table, --quick shortens every measurement for a smoke run,
+// --threads caps the thread scaling run (defaults to the hardware thread count).
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <functional>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "SimplexNoise.h"
+#include "terrain.h"
+
+namespace {
+
+// the game's noise settings, see application.cpp
+const float CHUNK_HEIGHT = 75.0f;
+const float LACUNARITY = 2.0f;
+const float PERSISTANCE = 0.3f;
+const int OCTAVES = 7;
+const int SAMPLE_COUNT = 4096;
+const int SCALING_MAP_SIZE = 20;
+const int SCALING_ROUNDS = 3;
+
+struct benchResult {
+    std::string group;
+    std::string name;
+    double nsPerSample;
+    double perSecond;   // samples/second for noise, chunks/second for chunk generation
+    std::string unit;   // what perSecond counts
+};
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs body (which does samplesPerCall samples) until minSeconds have passed and returns ns per sample.
+// One untimed call first so tables and caches are warm.
+double measure(double minSeconds, size_t samplesPerCall, const std::function<void()>& body) {
+    body();
+    size_t calls = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+    do {
+        body();
+        calls++;
+        elapsed = secondsSince(start);
+    } while (elapsed < minSeconds);
+    return elapsed * 1.0e9 / ((double)calls * samplesPerCall);
+}
+
+volatile float sink; // keeps the compiler from dropping noise results nothing else reads
+
+void noiseBenchmarks(double minSeconds, std::vector<benchResult>* results) {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> coordinate(-1000.0f, 1000.0f);
+    std::vector<float> xs(SAMPLE_COUNT), ys(SAMPLE_COUNT), zs(SAMPLE_COUNT), out(SAMPLE_COUNT);
+    for (int i = 0; i < SAMPLE_COUNT; i++) {
+        xs[i] = coordinate(rng);
+        ys[i] = coordinate(rng);
+        zs[i] = coordinate(rng);
+    }
+
+    auto add = [&](const std::string& group, const std::string& name, double ns) {
+        results->push_back({ group, name, ns, 1.0e9 / ns, "samples/s" });
+    };
+
+    add("noise", "noise 1D", measure(minSeconds, SAMPLE_COUNT, [&] {
+        float sum = 0.0f;
+        for (int i = 0; i < SAMPLE_COUNT; i++) {
+            sum += SimplexNoise::noise(xs[i]);
+        }
+        sink = sum;
+        }));
+    add("noise", "noise 2D", measure(minSeconds, SAMPLE_COUNT, [&] {
+        float sum = 0.0f;
+        for (int i = 0; i < SAMPLE_COUNT; i++) {
+            sum += SimplexNoise::noise(xs[i], ys[i]);
+        }
+        sink = sum;
+        }));
+    add("noise", "noise 3D", measure(minSeconds, SAMPLE_COUNT, [&] {
+        float sum = 0.0f;
+        for (int i = 0; i < SAMPLE_COUNT; i++) {
+            sum += SimplexNoise::noise(xs[i], ys[i], zs[i]);
+        }
+        sink = sum;
+        }));
+
+    // the terrain's own parameters, frequency and amplitude don't change the cost
+    SimplexNoise simplex(1.0f / 50.0f, 0.5f, LACUNARITY, PERSISTANCE);
+    const int GRID_SIDE = 64;
+    for (int octaves = 1; octaves <= 10; octaves++) {
+        std::string suffix = " " + std::to_string(octaves) + " octave" + (octaves > 1 ? "s" : "");
+        add("fractal", "fractal 2D" + suffix, measure(minSeconds, SAMPLE_COUNT, [&] {
+            float sum = 0.0f;
+            for (int i = 0; i < SAMPLE_COUNT; i++) {
+                sum += simplex.fractal(octaves, xs[i], ys[i]);
+            }
+            sink = sum;
+            }));
+        add("fractal", std::string("fractal2DGrid (") + SimplexNoise::batchKernelName() + ")" + suffix, measure(minSeconds, GRID_SIDE * GRID_SIDE, [&] {
+            simplex.fractal2DGrid(octaves, xs[0], ys[0], 1.0f, GRID_SIDE, GRID_SIDE, out.data());
+            sink = out[0];
+            }));
+    }
+}
+
+// Whole chunks on the calling thread, every call builds a chunk that was never built before so nothing is reused
+void chunkBenchmarks(double minSeconds, std::vector<benchResult>* results) {
+    struct chunkConfig {
+        int chunkSize;
+        int chunkResolution;
+    };
+    const chunkConfig configs[] = { { 25, 1 }, { 50, 1 }, { 50, 2 }, { 50, 5 }, { 100, 1 }, { 100, 2 } };
+
+    for (const chunkConfig& config : configs) {
+        Terrain terrain(CHUNK_HEIGHT, config.chunkResolution, LACUNARITY, PERSISTANCE, OCTAVES, 2, config.chunkSize, SHARED_VERTEX, PACKED_VERTEX, 1);
+        terrainChunk chunk;
+        int chunkX = 0;
+        terrain.generateChunkAt(&chunk, chunkX++, 0);
+        size_t samples = chunk.heightfield.size();
+        double ns = measure(minSeconds, samples, [&] {
+            terrain.generateChunkAt(&chunk, chunkX++, 0);
+            });
+        std::string name = "generateChunk size " + std::to_string(config.chunkSize) + " resolution " + std::to_string(config.chunkResolution);
+        results->push_back({ "chunk", name, ns, 1.0e9 / (ns * samples), "chunks/s" });
+    }
+}
+
+// The generation threads filling a whole chunk map window, from the requests to the last chunk built, with 1..maxThreads workers
+void scalingBenchmarks(unsigned int maxThreads, int rounds, std::vector<benchResult>* results) {
+    std::vector<unsigned int> threadCounts;
+    for (unsigned int threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    const int CHUNK_SIZE = 50;
+    for (unsigned int threads : threadCounts) {
+        Terrain terrain(CHUNK_HEIGHT, 1, LACUNARITY, PERSISTANCE, OCTAVES, SCALING_MAP_SIZE, CHUNK_SIZE, SHARED_VERTEX, PACKED_VERTEX, threads);
+        viewFrustum frustum = viewFrustum::everything();
+        int chunks = 0;
+        size_t samples = 0;
+        double seconds = 0.0;
+        for (int round = 0; round < rounds; round++) {
+            // far enough apart that no round finds chunks from the last one
+            float position = (float)(round * (SCALING_MAP_SIZE + 1) * 4 * CHUNK_SIZE);
+            int before = terrain.chunksGenerated;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            terrain.checkForVisibleChunks(SCALING_MAP_SIZE, position, position, frustum);
+            terrain.waitForGeneration();
+            seconds += secondsSince(start);
+            const std::vector<terrainChunk*>& built = terrain.checkForVisibleChunks(SCALING_MAP_SIZE, position, position, frustum);
+            chunks += terrain.chunksGenerated - before;
+            if (!built.empty()) {
+                samples += built.size() * built[0]->heightfield.size();
+            }
+        }
+        double ns = seconds * 1.0e9 / std::max<size_t>(samples, 1);
+        results->push_back({ "threads", std::to_string(threads) + " generation thread" + (threads > 1 ? "s" : ""), ns, chunks / seconds, "chunks/s" });
+    }
+}
+
+void printTable(const std::vector<benchResult>& results) {
+    std::string group;
+    for (const benchResult& result : results) {
+        if (result.group != group) {
+            group = result.group;
+            std::printf("\n%-48s %14s %16s\n", group.c_str(), "ns/sample", "throughput");
+        }
+        std::printf("%-48s %14.2f %16.1f %s\n", result.name.c_str(), result.nsPerSample, result.perSecond, result.unit.c_str());
+    }
+}
+
+void printJson(const std::vector<benchResult>& results) {
+    std::printf("[\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const benchResult& result = results[i];
+        std::printf("  { \"group\": \"%s\", \"name\": \"%s\", \"ns_per_sample\": %.4f, \"per_second\": %.4f, \"unit\": \"%s\" }%s\n",
+            result.group.c_str(), result.name.c_str(), result.nsPerSample, result.perSecond, result.unit.c_str(), i + 1 < results.size() ? "," : "");
+    }
+    std::printf("]\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    bool json = false;
+    bool quick = false;
+    unsigned int hardwareThreads = std::thread::hardware_concurrency();
+    unsigned int maxThreads = hardwareThreads > 0 ? hardwareThreads : 1;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--json") == 0) {
+            json = true;
+        }
+        else if (std::strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+            maxThreads = (unsigned int)std::atoi(argv[++i]);
+        }
+        else {
+            std::cout << "usage: terrain_bench [--json] [--quick] [--threads N]" << std::endl;
+            return -1;
+        }
+    }
+
+    double minSeconds = quick ? 0.02 : 0.25;
+    std::vector<benchResult> results;
+    noiseBenchmarks(minSeconds, &results);
+    chunkBenchmarks(minSeconds, &results);
+    scalingBenchmarks(maxThreads, quick ? 1 : SCALING_ROUNDS, &results);
+
+    if (json) {
+        printJson(results);
+    }
+    else {
+        printTable(results);
+    }
+    return 0;
+}